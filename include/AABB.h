@@ -0,0 +1,45 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include <Eigen/Core>
+#include <limits>
+
+// Axis-aligned bounding box. A default constructed box is empty (min > max)
+// so that inserting the first point or box makes it tight.
+struct AABB
+{
+  Eigen::Vector3d min_corner =
+    Eigen::Vector3d::Constant( std::numeric_limits<double>::infinity());
+  Eigen::Vector3d max_corner =
+    Eigen::Vector3d::Constant(-std::numeric_limits<double>::infinity());
+
+  // Grow this box to contain a point
+  void insert(const Eigen::Vector3d & p)
+  {
+    min_corner = min_corner.cwiseMin(p);
+    max_corner = max_corner.cwiseMax(p);
+  }
+  // Grow this box to contain another box
+  void insert(const AABB & box)
+  {
+    min_corner = min_corner.cwiseMin(box.min_corner);
+    max_corner = max_corner.cwiseMax(box.max_corner);
+  }
+  bool empty() const
+  {
+    return (min_corner.array() > max_corner.array()).any();
+  }
+  Eigen::Vector3d center() const
+  {
+    return 0.5 * (min_corner + max_corner);
+  }
+  // Surface area (0 for empty boxes), used by the SAH cost model
+  double surface_area() const
+  {
+    if(empty()) return 0.0;
+    const Eigen::Vector3d d = max_corner - min_corner;
+    return 2.0 * (d(0) * d(1) + d(1) * d(2) + d(2) * d(0));
+  }
+};
+
+#endif
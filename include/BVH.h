@@ -0,0 +1,723 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "AABB.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include "Object.h"
+#include "round_float.h"
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Bounding volume hierarchy over a list of primitives, built top-down with the
+// binned surface area heuristic (SAH). Primitives are referred to by their
+// index into the list the hierarchy was built from, so the same structure
+// accelerates scene objects (first_hit) and triangles inside a mesh.
+// Primitives without a bounding box (e.g., planes) are kept outside the tree
+// and handed to every traversal.
+//
+// The binary tree is then collapsed into a 4-wide tree (one AVX2 register of
+// doubles per child box coordinate) that the traversals walk, testing all
+// children of a node at once. Leaves are still identified by their binary
+// node, so callers keep per-leaf data indexed by `nodes`.
+//
+// In single precision (set_single_precision) the traversals walk a copy of
+// the collapsed tree with float boxes rounded outward instead: half the
+// memory per node and twice the lanes per SIMD register for packets. The
+// float test only culls boxes the double test would cull too, so the leaves
+// visited can only grow and callers that confirm hits in double get the same
+// results.
+class BVH
+{
+  public:
+    struct Node
+    {
+      AABB box;
+      // Leaf: index of first primitive in `indices`
+      // Interior: index of the second child (the first child is the next node)
+      int offset = 0;
+      // Number of primitives in leaf (0 for interior nodes)
+      int count = 0;
+    };
+    // Node of the collapsed tree: the boxes of up to WIDTH children stored
+    // structure-of-arrays
+    struct alignas(32) WideNode
+    {
+      static const int WIDTH = 4;
+      // min_corner[a][l] is coordinate a of the min corner of child l
+      double min_corner[3][WIDTH];
+      double max_corner[3][WIDTH];
+      // Child l: index into `nodes` of a leaf if bit l of leaf_mask is set,
+      // otherwise index into `wide_nodes`
+      int child[WIDTH];
+      int leaf_mask = 0;
+      // Children are in lanes [0,num_children)
+      int num_children = 0;
+    };
+    // WideNode with float boxes, each rounded outward so it contains the
+    // double one
+    struct alignas(16) FloatWideNode
+    {
+      float min_corner[3][WideNode::WIDTH];
+      float max_corner[3][WideNode::WIDTH];
+      int child[WideNode::WIDTH];
+      int leaf_mask = 0;
+      int num_children = 0;
+    };
+    // Flattened depth-first node array of the binary tree, root at 0
+    std::vector<Node> nodes;
+    // Collapsed tree over the same leaves, root at 0
+    std::vector<WideNode> wide_nodes;
+    // wide_nodes in single precision (empty unless set_single_precision)
+    std::vector<FloatWideNode> float_nodes;
+    // Primitive ids in leaf order
+    std::vector<int> indices;
+    // Primitive ids that have no bounding box
+    std::vector<int> unbounded;
+
+    // Build the hierarchy over a list of boxes.
+    //
+    // Inputs:
+    //   boxes  #boxes list of primitive boxes; empty boxes mark unbounded
+    //     primitives
+    //   block_size  number of primitives the caller intersects at once
+    //     (e.g., SIMD lanes); the SAH then charges a leaf of n primitives
+    //     ceil(n/block_size) intersection tests, which favours full leaves
+    void build(const std::vector<AABB> & boxes, const int block_size = 1);
+    // Build the hierarchy over the bounding boxes of a list of objects.
+    //
+    // Inputs:
+    //   objects  list of objects (shapes)
+    void build(const std::vector<std::shared_ptr<Object> > & objects);
+    // Returns true iff nothing has been built (first_hit falls back to testing
+    // every object)
+    bool empty() const { return nodes.empty() && unbounded.empty(); }
+    // Box around every bounded primitive (empty if there are none)
+    AABB bounds() const { return nodes.empty() ? AABB() : nodes[0].box; }
+    // Choose whether the traversals test float_nodes (kept up to date by
+    // later builds) or wide_nodes.
+    //
+    // Inputs:
+    //   single  true to traverse in single precision
+    void set_single_precision(const bool single);
+
+    // Visit every primitive whose box may be hit by a ray in [min_t,max_t].
+    // Nearer children are visited first so that `leaf` can shrink max_t and
+    // prune the rest of the traversal, or stop it altogether (any-hit
+    // queries).
+    //
+    // Inputs:
+    //   ray  ray to traverse with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider (may be updated by
+    //     `leaf` while traversing)
+    //   leaf  callable as leaf(id) for each candidate primitive id, returning
+    //     true to end the traversal
+    template <typename LeafFunc>
+    void traverse(
+      const Ray & ray,
+      const double min_t,
+      const double & max_t,
+      LeafFunc && leaf) const;
+    // Visit every leaf node whose box may be hit by a ray in [min_t,max_t],
+    // nearer leaves first, for callers that keep per-leaf data (e.g., packed
+    // triangle blocks). Unbounded primitives are not visited.
+    //
+    // Inputs:
+    //   ray  ray to traverse with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider (may be updated by
+    //     `leaf` while traversing)
+    //   leaf  callable as leaf(node_id) for each candidate leaf, returning
+    //     true to end the traversal
+    template <typename LeafFunc>
+    void traverse_leaves(
+      const Ray & ray,
+      const double min_t,
+      const double & max_t,
+      LeafFunc && leaf) const;
+
+    // Visit every leaf node whose box may be hit by some ray of a packet,
+    // with the rays that hit it. All rays walk the tree together: every node
+    // is fetched once per packet, its children are tested against the rays
+    // in SIMD and visited nearest first. Meant for coherent packets (see
+    // RayPacket::coherent); others still work but share little. Where only
+    // a ray or two still reach a node, each finishes the subtree alone.
+    //
+    // Inputs:
+    //   packet  rays to traverse with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  RayPacket::SIZE list of maximum parametric distances per ray
+    //     (may be updated by `leaf` while traversing)
+    //   active  bitmask of rays to traverse with
+    //   leaf  callable as leaf(node_id, mask) for each candidate leaf and
+    //     bitmask of the active rays that may hit it
+    template <typename LeafFunc>
+    void traverse_leaves_packet(
+      const RayPacket & packet,
+      const double min_t,
+      const double * max_t,
+      const std::uint64_t active,
+      LeafFunc && leaf) const;
+
+  private:
+    // Rays a packet traversal keeps together below which it finishes a
+    // subtree with each remaining ray on its own: a nearly empty packet
+    // still pays a box test per child, where a single ray tests all the
+    // children of a node at once
+    static const int SPARSE_PACKET_RAYS = 2;
+    // traverse_leaves, starting at wide interior node `root`
+    template <typename LeafFunc>
+    void traverse_leaves_from(
+      const Ray & ray,
+      const int root,
+      const double min_t,
+      const double & max_t,
+      LeafFunc && leaf) const;
+    // block_size of the last build
+    int block_size = 1;
+    // See set_single_precision
+    bool single = false;
+    int build_recursive(
+      const std::vector<AABB> & boxes,
+      const std::vector<Eigen::Vector3d> & centroids,
+      const int begin,
+      const int end,
+      const int depth);
+    // Append the wide node standing for binary interior node `node_id` (and,
+    // recursively, its descendants). Returns its index in `wide_nodes`.
+    int collapse(const int node_id);
+};
+
+// Implementation
+
+// Conservative slab test of a ray against every child box of a wide node:
+// boxes are padded at build time and tfar is scaled up slightly so rounding
+// can never cull a box the primitive inside it would report a hit for. NaNs
+// (0 * inf when the origin lies on a slab of an axis-parallel ray) are
+// ignored by the ordering of the min/max operands.
+//
+// Inputs:
+//   node  node whose children to test
+//   origin  ray origin
+//   inv_dir  componentwise inverse of the ray direction
+//   min_t  minimum parametric distance to consider
+//   max_t  maximum parametric distance to consider
+// Outputs:
+//   tnear  WIDTH list of parametric distances at which the ray enters each
+//     box (valid for lanes that hit)
+// Returns bitmask of children whose boxes are hit in [min_t,max_t]
+inline int ray_intersect_wide_node(
+  const BVH::WideNode & node,
+  const Eigen::Vector3d & origin,
+  const Eigen::Vector3d & inv_dir,
+  const double min_t,
+  const double max_t,
+  double * tnear)
+{
+  const int valid = (1 << node.num_children) - 1;
+#ifdef __AVX2__
+  // _mm256_min_pd(a,b) is a < b ? a : b, matching std::min(b,a)
+  __m256d near = _mm256_set1_pd(min_t);
+  __m256d far = _mm256_set1_pd(max_t);
+  const __m256d scale = _mm256_set1_pd(1.0 + 1e-12);
+  for(int a = 0; a < 3; ++a)
+  {
+    const __m256d o = _mm256_set1_pd(origin(a));
+    const __m256d inv = _mm256_set1_pd(inv_dir(a));
+    const __m256d t0 = _mm256_mul_pd(
+      _mm256_sub_pd(_mm256_load_pd(node.min_corner[a]), o), inv);
+    const __m256d t1 = _mm256_mul_pd(
+      _mm256_sub_pd(_mm256_load_pd(node.max_corner[a]), o), inv);
+    near = _mm256_max_pd(_mm256_min_pd(t1, t0), near);
+    far = _mm256_min_pd(_mm256_mul_pd(_mm256_max_pd(t1, t0), scale), far);
+  }
+  _mm256_storeu_pd(tnear, near);
+  return valid & _mm256_movemask_pd(_mm256_cmp_pd(near, far, _CMP_LE_OQ));
+#else
+  int hits = 0;
+  for(int l = 0; l < BVH::WideNode::WIDTH; ++l)
+  {
+    double tn = min_t;
+    double tf = max_t;
+    for(int a = 0; a < 3; ++a)
+    {
+      const double t0 = (node.min_corner[a][l] - origin(a)) * inv_dir(a);
+      const double t1 = (node.max_corner[a][l] - origin(a)) * inv_dir(a);
+      tn = std::max(tn, std::min(t0, t1));
+      tf = std::min(tf, std::max(t0, t1) * (1.0 + 1e-12));
+    }
+    tnear[l] = tn;
+    hits |= static_cast<int>(tn <= tf) << l;
+  }
+  return valid & hits;
+#endif
+}
+
+// A ray rounded to single precision for the slab tests of
+// BVH::FloatWideNode. The origin is bracketed by the nearest floats below and
+// above it: subtracting the bracket end that widens each slab keeps the
+// rounded slabs around the exact ones.
+struct FloatSlabRay
+{
+  float origin_lo[3];
+  float origin_hi[3];
+  float inv_dir[3];
+
+  // Inputs:
+  //   origin  ray origin
+  //   inv_dir  componentwise inverse of the ray direction
+  FloatSlabRay(const Eigen::Vector3d & origin, const Eigen::Vector3d & inv_dir)
+  {
+    for(int a = 0; a < 3; ++a)
+    {
+      origin_lo[a] = round_down_float(origin(a));
+      origin_hi[a] = round_up_float(origin(a));
+      this->inv_dir[a] = static_cast<float>(inv_dir(a));
+    }
+  }
+};
+
+// Relative slack of the single precision slab tests: covers the rounding of
+// the direction, the subtraction and the product (a few float ulps) with a
+// wide margin
+const float FLOAT_SLAB_SLACK = 1e-6f;
+
+// Conservative slab test of a ray against every child box of a single
+// precision wide node (see ray_intersect_wide_node). Box corners are rounded
+// outward, the origin bracket widens every slab, and tnear/tfar are scaled
+// down/up by FLOAT_SLAB_SLACK (which also covers rounding min_t and max_t to
+// nearest), so a box is only culled if the ray misses it in exact arithmetic
+// (for min_t >= 0).
+//
+// Inputs:
+//   node  node whose children to test
+//   ray  ray rounded to single precision
+//   min_t  minimum parametric distance to consider
+//   max_t  maximum parametric distance to consider
+// Outputs:
+//   tnear  WIDTH list of parametric distances at which the ray enters each
+//     box, rounded down (valid for lanes that hit)
+// Returns bitmask of children whose boxes are hit in [min_t,max_t]
+inline int ray_intersect_wide_node(
+  const BVH::FloatWideNode & node,
+  const FloatSlabRay & ray,
+  const double min_t,
+  const double max_t,
+  double * tnear)
+{
+  const int valid = (1 << node.num_children) - 1;
+#ifdef __AVX2__
+  // Same operand order as the double test, so NaNs are ignored the same way
+  __m128 near = _mm_set1_ps(static_cast<float>(min_t));
+  __m128 far = _mm_set1_ps(static_cast<float>(max_t));
+  for(int a = 0; a < 3; ++a)
+  {
+    const __m128 inv = _mm_set1_ps(ray.inv_dir[a]);
+    const __m128 t0 = _mm_mul_ps(
+      _mm_sub_ps(_mm_load_ps(node.min_corner[a]), _mm_set1_ps(ray.origin_hi[a])),
+      inv);
+    const __m128 t1 = _mm_mul_ps(
+      _mm_sub_ps(_mm_load_ps(node.max_corner[a]), _mm_set1_ps(ray.origin_lo[a])),
+      inv);
+    near = _mm_max_ps(_mm_min_ps(t1, t0), near);
+    far = _mm_min_ps(_mm_max_ps(t1, t0), far);
+  }
+  near = _mm_mul_ps(near, _mm_set1_ps(1.0f - FLOAT_SLAB_SLACK));
+  far = _mm_mul_ps(far, _mm_set1_ps(1.0f + FLOAT_SLAB_SLACK));
+  _mm256_storeu_pd(tnear, _mm256_cvtps_pd(near));
+  return valid & _mm_movemask_ps(_mm_cmp_ps(near, far, _CMP_LE_OQ));
+#else
+  int hits = 0;
+  for(int l = 0; l < BVH::WideNode::WIDTH; ++l)
+  {
+    float tn = static_cast<float>(min_t);
+    float tf = static_cast<float>(max_t);
+    for(int a = 0; a < 3; ++a)
+    {
+      const float t0 = (node.min_corner[a][l] - ray.origin_hi[a]) * ray.inv_dir[a];
+      const float t1 = (node.max_corner[a][l] - ray.origin_lo[a]) * ray.inv_dir[a];
+      tn = std::max(tn, std::min(t0, t1));
+      tf = std::min(tf, std::max(t0, t1));
+    }
+    tn *= 1.0f - FLOAT_SLAB_SLACK;
+    tf *= 1.0f + FLOAT_SLAB_SLACK;
+    tnear[l] = tn;
+    hits |= static_cast<int>(tn <= tf) << l;
+  }
+  return valid & hits;
+#endif
+}
+
+// Slab test of one box against the rays of a packet, four rays per AVX2
+// operation. Performs exactly the operations of ray_intersect_wide_node for
+// each ray, so a ray culls the same boxes alone or in a packet.
+//
+// Inputs:
+//   packet  rays to test
+//   min_corner  min corner of the box (x,y,z)
+//   max_corner  max corner of the box (x,y,z)
+//   min_t  minimum parametric distance to consider
+//   max_t  RayPacket::SIZE list of maximum parametric distances per ray
+//   active  bitmask of rays to test
+// Outputs:
+//   tnear  RayPacket::SIZE list of parametric distances at which each ray
+//     enters the box (valid for rays that hit)
+// Returns bitmask of active rays that hit the box in [min_t,max_t]
+inline std::uint64_t ray_packet_intersect_box(
+  const RayPacket & packet,
+  const double * min_corner,
+  const double * max_corner,
+  const double min_t,
+  const double * max_t,
+  const std::uint64_t active,
+  double * tnear)
+{
+  std::uint64_t hits = 0;
+  for(int g = 0; g < packet.count; g += 4)
+  {
+    if(!((active >> g) & 0xF)) continue;
+#ifdef __AVX2__
+    __m256d near = _mm256_set1_pd(min_t);
+    __m256d far = _mm256_loadu_pd(max_t + g);
+    const __m256d scale = _mm256_set1_pd(1.0 + 1e-12);
+    for(int a = 0; a < 3; ++a)
+    {
+      const __m256d o = _mm256_load_pd(packet.origin[a] + g);
+      const __m256d inv = _mm256_load_pd(packet.inv_dir[a] + g);
+      const __m256d t0 = _mm256_mul_pd(
+        _mm256_sub_pd(_mm256_set1_pd(min_corner[a]), o), inv);
+      const __m256d t1 = _mm256_mul_pd(
+        _mm256_sub_pd(_mm256_set1_pd(max_corner[a]), o), inv);
+      near = _mm256_max_pd(_mm256_min_pd(t1, t0), near);
+      far = _mm256_min_pd(_mm256_mul_pd(_mm256_max_pd(t1, t0), scale), far);
+    }
+    _mm256_storeu_pd(tnear + g, near);
+    hits |= static_cast<std::uint64_t>(
+      _mm256_movemask_pd(_mm256_cmp_pd(near, far, _CMP_LE_OQ))) << g;
+#else
+    for(int l = g; l < g + 4; ++l)
+    {
+      double tn = min_t;
+      double tf = max_t[l];
+      for(int a = 0; a < 3; ++a)
+      {
+        const double t0 = (min_corner[a] - packet.origin[a][l]) * packet.inv_dir[a][l];
+        const double t1 = (max_corner[a] - packet.origin[a][l]) * packet.inv_dir[a][l];
+        tn = std::max(tn, std::min(t0, t1));
+        tf = std::min(tf, std::max(t0, t1) * (1.0 + 1e-12));
+      }
+      tnear[l] = tn;
+      hits |= static_cast<std::uint64_t>(tn <= tf) << l;
+    }
+#endif
+  }
+  return hits & active;
+}
+
+// Single precision slab test of one box against the rays of a packet, eight
+// rays per AVX2 operation, using the packet's float lanes. Performs exactly
+// the operations of the FloatWideNode ray_intersect_wide_node for each ray.
+//
+// Inputs:
+//   packet  rays to test
+//   min_corner  min corner of the box (x,y,z), rounded down
+//   max_corner  max corner of the box (x,y,z), rounded up
+//   min_t  minimum parametric distance to consider
+//   max_t  RayPacket::SIZE list of maximum parametric distances per ray
+//   active  bitmask of rays to test
+// Outputs:
+//   tnear  RayPacket::SIZE list of parametric distances at which each ray
+//     enters the box, rounded down (valid for rays that hit)
+// Returns bitmask of active rays that hit the box in [min_t,max_t]
+inline std::uint64_t ray_packet_intersect_box(
+  const RayPacket & packet,
+  const float * min_corner,
+  const float * max_corner,
+  const double min_t,
+  const double * max_t,
+  const std::uint64_t active,
+  double * tnear)
+{
+  std::uint64_t hits = 0;
+  const float near_t = static_cast<float>(min_t);
+  for(int g = 0; g < packet.count; g += 8)
+  {
+    if(!((active >> g) & 0xFF)) continue;
+#ifdef __AVX2__
+    __m256 near = _mm256_set1_ps(near_t);
+    __m256 far = _mm256_set_m128(
+      _mm256_cvtpd_ps(_mm256_loadu_pd(max_t + g + 4)),
+      _mm256_cvtpd_ps(_mm256_loadu_pd(max_t + g)));
+    for(int a = 0; a < 3; ++a)
+    {
+      const __m256 inv = _mm256_load_ps(packet.inv_dir_float[a] + g);
+      const __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(
+        _mm256_set1_ps(min_corner[a]), _mm256_load_ps(packet.origin_hi[a] + g)),
+        inv);
+      const __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(
+        _mm256_set1_ps(max_corner[a]), _mm256_load_ps(packet.origin_lo[a] + g)),
+        inv);
+      near = _mm256_max_ps(_mm256_min_ps(t1, t0), near);
+      far = _mm256_min_ps(_mm256_max_ps(t1, t0), far);
+    }
+    near = _mm256_mul_ps(near, _mm256_set1_ps(1.0f - FLOAT_SLAB_SLACK));
+    far = _mm256_mul_ps(far, _mm256_set1_ps(1.0f + FLOAT_SLAB_SLACK));
+    _mm256_storeu_pd(tnear + g, _mm256_cvtps_pd(_mm256_castps256_ps128(near)));
+    _mm256_storeu_pd(tnear + g + 4, _mm256_cvtps_pd(_mm256_extractf128_ps(near, 1)));
+    hits |= static_cast<std::uint64_t>(
+      _mm256_movemask_ps(_mm256_cmp_ps(near, far, _CMP_LE_OQ))) << g;
+#else
+    for(int l = g; l < g + 8; ++l)
+    {
+      float tn = near_t;
+      float tf = static_cast<float>(max_t[l]);
+      for(int a = 0; a < 3; ++a)
+      {
+        const float t0 =
+          (min_corner[a] - packet.origin_hi[a][l]) * packet.inv_dir_float[a][l];
+        const float t1 =
+          (max_corner[a] - packet.origin_lo[a][l]) * packet.inv_dir_float[a][l];
+        tn = std::max(tn, std::min(t0, t1));
+        tf = std::min(tf, std::max(t0, t1));
+      }
+      tn *= 1.0f - FLOAT_SLAB_SLACK;
+      tf *= 1.0f + FLOAT_SLAB_SLACK;
+      tnear[l] = tn;
+      hits |= static_cast<std::uint64_t>(tn <= tf) << l;
+    }
+#endif
+  }
+  return hits & active;
+}
+
+template <typename LeafFunc>
+inline void BVH::traverse(
+  const Ray & ray,
+  const double min_t,
+  const double & max_t,
+  LeafFunc && leaf) const
+{
+  for(const int id : unbounded)
+  {
+    if(leaf(id)) return;
+  }
+  traverse_leaves(ray, min_t, max_t, [&](const int node_id)
+  {
+    const Node & node = nodes[node_id];
+    for(int k = node.offset; k < node.offset + node.count; ++k)
+    {
+      if(leaf(indices[k])) return true;
+    }
+    return false;
+  });
+}
+
+template <typename LeafFunc>
+inline void BVH::traverse_leaves(
+  const Ray & ray,
+  const double min_t,
+  const double & max_t,
+  LeafFunc && leaf) const
+{
+  if(wide_nodes.empty()) return;
+  traverse_leaves_from(ray, 0, min_t, max_t, leaf);
+}
+
+template <typename LeafFunc>
+inline void BVH::traverse_leaves_from(
+  const Ray & ray,
+  const int root,
+  const double min_t,
+  const double & max_t,
+  LeafFunc && leaf) const
+{
+  const Eigen::Vector3d inv_dir = ray.direction.cwiseInverse();
+  const FloatSlabRay float_ray(ray.origin, inv_dir);
+
+  // Pending children, nearest on top. Each entry remembers where the ray
+  // enters its box so it can be dropped once `leaf` shrinks max_t below that.
+  struct Entry
+  {
+    double tnear;
+    int id;
+    bool is_leaf;
+  };
+  // build_recursive bounds the depth well below 128, and a wide node adds
+  // at most WIDTH entries for the one it replaces
+  Entry stack[128 * (WideNode::WIDTH - 1) + 1];
+  int stack_size = 0;
+  stack[stack_size++] = {min_t, root, false};
+  while(stack_size > 0)
+  {
+    const Entry entry = stack[--stack_size];
+    if(entry.tnear > max_t) continue;
+    if(entry.is_leaf)
+    {
+      if(leaf(entry.id)) return;
+      continue;
+    }
+
+    alignas(32) double tnear[WideNode::WIDTH];
+    int hits;
+    const int * child;
+    int leaf_mask;
+    if(single)
+    {
+      const FloatWideNode & node = float_nodes[entry.id];
+      hits = ray_intersect_wide_node(node, float_ray, min_t, max_t, tnear);
+      child = node.child;
+      leaf_mask = node.leaf_mask;
+    }else
+    {
+      const WideNode & node = wide_nodes[entry.id];
+      hits = ray_intersect_wide_node(
+        node, ray.origin, inv_dir, min_t, max_t, tnear);
+      child = node.child;
+      leaf_mask = node.leaf_mask;
+    }
+    // Sort the hit children farthest first (insertion sort of at most WIDTH
+    // lanes) and push them in that order, so the nearest is visited next
+    int order[WideNode::WIDTH];
+    int num_hits = 0;
+    for(int l = 0; hits; ++l, hits >>= 1)
+    {
+      if(!(hits & 1)) continue;
+      int k = num_hits++;
+      for(; k > 0 && tnear[order[k - 1]] < tnear[l]; --k)
+      {
+        order[k] = order[k - 1];
+      }
+      order[k] = l;
+    }
+    for(int k = 0; k < num_hits; ++k)
+    {
+      const int l = order[k];
+      stack[stack_size++] = {tnear[l], child[l], ((leaf_mask >> l) & 1) != 0};
+    }
+  }
+}
+
+template <typename LeafFunc>
+inline void BVH::traverse_leaves_packet(
+  const RayPacket & packet,
+  const double min_t,
+  const double * max_t,
+  const std::uint64_t active,
+  LeafFunc && leaf) const
+{
+  if(wide_nodes.empty() || !active) return;
+
+  // Pending children with the rays that hit them, nearest on top (see
+  // traverse_leaves)
+  struct Entry
+  {
+    std::uint64_t mask;
+    double tnear;
+    int id;
+    bool is_leaf;
+  };
+  Entry stack[128 * (WideNode::WIDTH - 1) + 1];
+  int stack_size = 0;
+  stack[stack_size++] = {active, min_t, 0, false};
+  alignas(32) double tnear[RayPacket::SIZE];
+  while(stack_size > 0)
+  {
+    const Entry entry = stack[--stack_size];
+    // Drop the rays whose max_t has shrunk below the box since it was pushed
+    std::uint64_t mask = 0;
+    std::uint64_t bits = entry.mask;
+    for(int l = 0; bits; ++l, bits >>= 1)
+    {
+      if((bits & 1) && !(entry.tnear > max_t[l]))
+      {
+        mask |= std::uint64_t(1) << l;
+      }
+    }
+    if(!mask) continue;
+    if(entry.is_leaf)
+    {
+      leaf(entry.id, mask);
+      continue;
+    }
+    int num_rays = 0;
+    for(bits = mask; bits; bits &= bits - 1) ++num_rays;
+    if(num_rays <= SPARSE_PACKET_RAYS)
+    {
+      bits = mask;
+      for(int l = 0; bits; ++l, bits >>= 1)
+      {
+        if(!(bits & 1)) continue;
+        const std::uint64_t lane = std::uint64_t(1) << l;
+        traverse_leaves_from(
+          packet.ray(l), entry.id, min_t, max_t[l],
+          [&](const int node_id) { leaf(node_id, lane); return false; });
+      }
+      continue;
+    }
+
+    const WideNode * node = single ? nullptr : &wide_nodes[entry.id];
+    const FloatWideNode * float_node = single ? &float_nodes[entry.id] : nullptr;
+    const int num_children =
+      single ? float_node->num_children : node->num_children;
+    const int * child = single ? float_node->child : node->child;
+    const int leaf_mask = single ? float_node->leaf_mask : node->leaf_mask;
+    std::uint64_t child_mask[WideNode::WIDTH];
+    double child_near[WideNode::WIDTH];
+    int order[WideNode::WIDTH];
+    int num_hits = 0;
+    for(int c = 0; c < num_children; ++c)
+    {
+      if(single)
+      {
+        const float lo[3] = {
+          float_node->min_corner[0][c],
+          float_node->min_corner[1][c],
+          float_node->min_corner[2][c]};
+        const float hi[3] = {
+          float_node->max_corner[0][c],
+          float_node->max_corner[1][c],
+          float_node->max_corner[2][c]};
+        child_mask[c] = ray_packet_intersect_box(
+          packet, lo, hi, min_t, max_t, mask, tnear);
+      }else
+      {
+        const double lo[3] = {
+          node->min_corner[0][c], node->min_corner[1][c], node->min_corner[2][c]};
+        const double hi[3] = {
+          node->max_corner[0][c], node->max_corner[1][c], node->max_corner[2][c]};
+        child_mask[c] = ray_packet_intersect_box(
+          packet, lo, hi, min_t, max_t, mask, tnear);
+      }
+      if(!child_mask[c]) continue;
+      // The box starts for the packet where its nearest ray enters it
+      child_near[c] = std::numeric_limits<double>::infinity();
+      bits = child_mask[c];
+      for(int l = 0; bits; ++l, bits >>= 1)
+      {
+        if(bits & 1) child_near[c] = std::min(child_near[c], tnear[l]);
+      }
+      // Farthest first, as in traverse_leaves
+      int k = num_hits++;
+      for(; k > 0 && child_near[order[k - 1]] < child_near[c]; --k)
+      {
+        order[k] = order[k - 1];
+      }
+      order[k] = c;
+    }
+    for(int k = 0; k < num_hits; ++k)
+    {
+      const int c = order[k];
+      stack[stack_size++] = {
+        child_mask[c], child_near[c], child[c], ((leaf_mask >> c) & 1) != 0};
+    }
+  }
+}
+
+#endif
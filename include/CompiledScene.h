@@ -0,0 +1,165 @@
+#ifndef COMPILED_SCENE_H
+#define COMPILED_SCENE_H
+
+#include "Object.h"
+#include "BVH.h"
+#include "Ray.h"
+#include "RayPacket.h"
+#include <Eigen/Core>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Render-time form of a list of scene objects. Objects stay the authoring
+// interface (read_json builds them, materials are looked up through them);
+// before rendering they are compiled into a BVH whose leaves refer to
+// primitives stored by concrete type in contiguous arrays (spheres, planes,
+// triangles), in the order the traversal meets them. Queries dispatch on a
+// small type tag with the intersection code inlined instead of making a
+// virtual call per candidate. Aggregate objects (meshes, sphere sets, and
+// any other Object) are kept as a fourth kind reached through
+// Object::intersect_hit, which only costs one call per aggregate. Candidates
+// are bounded by the closest hit so far and the normal is only computed for
+// the final hit.
+//
+// Compiled in single precision, the hierarchies (the scene's and those of
+// meshes and sphere sets) are stored and traversed in float and mesh faces
+// are culled in float before the survivors are tested in double. Single
+// precision only ever culls, so the hits, and the epsilons shading offsets
+// rays by, are unchanged; it trades a little refinement work for half the
+// memory traffic in the traversal. Objects with hierarchies of their own are
+// compiled from single precision copies (see Object::single_precision_copy)
+// kept by the scene, so the objects themselves, and other scenes compiled
+// from them, are left as they are. The copies share the objects' vertices,
+// faces and spheres and only add their own float hierarchies and blocks.
+//
+// Hits are exactly those of the Object-based first_hit/occluded.
+class CompiledScene
+{
+  public:
+    enum PrimitiveType
+    {
+      SPHERE = 0,
+      PLANE = 1,
+      TRIANGLE = 2,
+      // Any other Object
+      OTHER = 3
+    };
+    struct Primitive
+    {
+      // PrimitiveType
+      int type = OTHER;
+      // Index into the array of that type
+      int index = 0;
+      // Index into the objects the scene was compiled from
+      int object_id = 0;
+    };
+    struct Sphere
+    {
+      Eigen::Vector3d center;
+      double radius;
+    };
+    struct Plane
+    {
+      Eigen::Vector3d point;
+      Eigen::Vector3d normal;
+      // normal.normalized(), reported for hits
+      Eigen::Vector3d unit_normal;
+    };
+    struct Triangle
+    {
+      Eigen::Vector3d v0;
+      // Edges v1-v0 and v2-v0
+      Eigen::Vector3d e1;
+      Eigen::Vector3d e2;
+      Eigen::Vector3d normal;
+    };
+
+    // Hierarchy over the objects (empty when compiled without one)
+    BVH bvh;
+    // Primitives of the BVH leaves: leaf node k owns primitives[k.offset] up
+    // to primitives[k.offset + k.count] (sorted by type within a leaf)
+    std::vector<Primitive> primitives;
+    // Primitives tested for every ray (no bounding box, or no BVH)
+    std::vector<Primitive> unbounded;
+    std::vector<Sphere> spheres;
+    std::vector<Plane> planes;
+    std::vector<Triangle> triangles;
+    // Objects of type OTHER (not owned, unless they are single precision
+    // copies)
+    std::vector<const Object *> others;
+    // Single precision copies of the objects that need one (see
+    // Object::single_precision_copy), by original
+    SinglePrecisionCopies copies;
+
+    // Compile a list of objects. The objects must outlive the compiled scene
+    // (OTHER primitives point to them).
+    //
+    // Inputs:
+    //   objects  list of objects (shapes) in the scene
+    //   use_bvh  whether to build a hierarchy (otherwise every primitive is
+    //     tested for every ray, for A/B comparisons)
+    //   single_precision  whether to traverse in single precision (objects
+    //     with hierarchies of their own are replaced by their single precision
+    //     copies)
+    void build(
+      const std::vector<std::shared_ptr<Object> > & objects,
+      const bool use_bvh = true,
+      const bool single_precision = false);
+    // Find the first (visible) hit along a ray (see first_hit).
+    //
+    // Inputs:
+    //   ray  ray along which to search
+    //   min_t  minimum t value to consider
+    // Outputs:
+    //   hit_id  index into objects of object with first hit (ties are broken
+    //     toward the lower index)
+    //   hit_part  part of objects[hit_id] that was hit
+    //   t  _parametric_ distance along ray so that ray.origin+t*ray.direction
+    //     is the hit location
+    //   n  surface normal at hit location
+    // Returns true iff a hit was found
+    bool first_hit(
+      const Ray & ray,
+      const double min_t,
+      int & hit_id,
+      int & hit_part,
+      double & t,
+      Eigen::Vector3d & n) const;
+    // Find the first hit of every ray of a packet (see first_hit). Coherent
+    // packets (e.g., neighbouring camera rays) traverse the hierarchy
+    // together; otherwise each ray is traced on its own. The hits are
+    // exactly those of first_hit.
+    //
+    // Inputs:
+    //   packet  rays along which to search
+    //   min_t  minimum t value to consider
+    // Outputs:
+    //   hit_id  packet.count list of hit object indices
+    //   hit_part  packet.count list of parts hit
+    //   t  packet.count list of parametric distances of the hits
+    //   n  packet.count list of surface normals at the hits
+    // Returns bitmask of the rays that hit something (the outputs of the
+    // other rays are unspecified)
+    std::uint64_t first_hit_packet(
+      const RayPacket & packet,
+      const double min_t,
+      int * hit_id,
+      int * hit_part,
+      double * t,
+      Eigen::Vector3d * n) const;
+    // Determine whether anything blocks a ray within a parametric interval
+    // (see occluded).
+    //
+    // Inputs:
+    //   ray  ray along which to search
+    //   min_t  minimum t value to consider
+    //   max_t  maximum t value to consider (exclusive; may be infinite)
+    // Returns true iff first_hit would find a hit with t < max_t
+    bool occluded(
+      const Ray & ray,
+      const double min_t,
+      const double max_t) const;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef GROUP_H
+#define GROUP_H
+
+#include "Object.h"
+#include "BVH.h"
+#include <Eigen/Core>
+#include <memory>
+#include <vector>
+
+// Objects that belong together (e.g., the spheres and meshes of one tree)
+// intersected as one object through their own BVH, so a group can be placed
+// many times by Instances while being stored once. The parts of the children
+// are numbered consecutively: part p of child k is part part_offsets[k] + p
+// of the group, which lets hits carry the child they came from through any
+// depth of groups and instances.
+class Group : public Object
+{
+  public:
+    // Children, in their common frame
+    std::vector<std::shared_ptr<Object> > objects;
+    // Hierarchy over the children, built once they are added with build().
+    // If empty, every child is tested.
+    BVH bvh;
+    // #objects+1 list: child k owns the group's parts part_offsets[k] up to
+    // part_offsets[k+1]
+    std::vector<int> part_offsets{0};
+
+    // Build `bvh` over the children and number their parts
+    void build();
+
+    // Intersect the group with ray.
+    //
+    // Inputs:
+    //   Ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    // Outputs:
+    //   t  first intersection at ray.origin + t * ray.direction
+    //   n  surface normal at point of intersection
+    // Returns iff there a first intersection is found.
+    bool intersect(
+      const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const;
+    // Find the first child hit in [min_t,max_t) (see Object::intersect_hit).
+    //
+    // Outputs:
+    //   hit  hit of the child (ties go to the lower index), with hit.part
+    //     offset to the group's numbering
+    bool intersect_hit(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      Hit & hit) const;
+    // Returns the normal of the child hit
+    Eigen::Vector3d surface_normal(const Ray & ray, const Hit & hit) const;
+    // Returns material of the child part numbered `part` in the group
+    const Material & part_material(const int part) const;
+    // Returns total number of parts of the children
+    int num_parts() const { return part_offsets.back(); }
+    // Determine whether any child blocks a ray in [min_t,max_t).
+    //
+    // Inputs:
+    //   ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider (exclusive)
+    // Returns true iff intersect would find a hit with t < max_t
+    bool occluded(
+      const Ray & ray, const double min_t, const double max_t) const;
+    // Axis-aligned bounding box of the group.
+    //
+    // Outputs:
+    //   box  box around the boxes of all children
+    // Returns false iff some child is unbounded (or the group is empty)
+    bool bounding_box(AABB & box) const;
+    // Copy of the group over the single precision forms of its children
+    // with its BVH in single precision (see Object::single_precision_copy)
+    std::shared_ptr<Object> single_precision_copy(
+      SinglePrecisionCopies & copies) const;
+
+  private:
+    // Returns index of the child owning group part `part`
+    int child_of_part(const int part) const;
+};
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef HIT_H
+#define HIT_H
+
+// Where a ray hit an object, before any shading attributes are computed.
+// Queries fill this in for every candidate they accept; the surface normal is
+// only reconstructed from it (Object::surface_normal) for the closest hit.
+struct Hit
+{
+  // Parametric distance along the ray
+  double t = 0;
+  // Part of the object that was hit (see Object::part_material)
+  int part = 0;
+  // Primitive of the object that was hit (e.g., face of a mesh, sphere of a
+  // sphere set; 0 for single primitives)
+  int primitive = 0;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "Object.h"
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <memory>
+
+// One placement of a shared object (e.g., a mesh or a Group) under an affine
+// transform. Rays are moved into the object's frame instead of copying its
+// geometry, so any number of instances cost the memory of one copy plus a
+// transform each. The direction is transformed without normalizing, so
+// parametric distances are the same in both frames and hits need no
+// conversion.
+class Instance : public Object
+{
+  public:
+    // Shared object, in its own frame
+    std::shared_ptr<Object> object;
+
+    // Inputs:
+    //   object  object to place
+    //   transform  map from the object's frame to the world
+    Instance(
+      const std::shared_ptr<Object> & object,
+      const Eigen::Affine3d & transform);
+    // Returns map from the object's frame to the world
+    const Eigen::Affine3d & transform() const { return to_world; }
+
+    // Intersect the placed object with ray.
+    //
+    // Inputs:
+    //   Ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    // Outputs:
+    //   t  first intersection at ray.origin + t * ray.direction
+    //   n  surface normal at point of intersection
+    // Returns iff there a first intersection is found.
+    bool intersect(
+      const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const;
+    // Find the first hit of the placed object in [min_t,max_t) (see
+    // Object::intersect_hit).
+    //
+    // Outputs:
+    //   hit  hit reported by the object for the ray in its frame
+    bool intersect_hit(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      Hit & hit) const;
+    // Returns the object's normal at the hit, carried to the world by the
+    // inverse transpose of the transform
+    Eigen::Vector3d surface_normal(const Ray & ray, const Hit & hit) const;
+    // Returns the instance's own material if it has one, otherwise the
+    // object's material of that part
+    const Material & part_material(const int part) const;
+    // Returns number of parts of the object
+    int num_parts() const { return object->num_parts(); }
+    // Determine whether the placed object blocks a ray in [min_t,max_t).
+    //
+    // Inputs:
+    //   ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider (exclusive)
+    // Returns true iff intersect would find a hit with t < max_t
+    bool occluded(
+      const Ray & ray, const double min_t, const double max_t) const;
+    // Axis-aligned bounding box of the placed object.
+    //
+    // Outputs:
+    //   box  box around the transformed corners of the object's box
+    // Returns false iff the object is unbounded
+    bool bounding_box(AABB & box) const;
+    // Copy of the instance placing the single precision form of the object
+    // (see Object::single_precision_copy), or nullptr if the object needs
+    // none. Instances of one object share its copy.
+    std::shared_ptr<Object> single_precision_copy(
+      SinglePrecisionCopies & copies) const;
+
+  private:
+    Eigen::Affine3d to_world;
+    Eigen::Affine3d to_object;
+    // Inverse transpose of the linear part of to_world
+    Eigen::Matrix3d normal_matrix;
+    // Identity placements pass rays through untouched (bit-identical hits)
+    bool identity;
+    // Returns ray in the object's frame
+    Ray object_ray(const Ray & ray) const;
+};
+
+#endif
@@ -2,10 +2,19 @@
 #define OBJECT_H
 
 #include "Material.h"
+#include "AABB.h"
+#include "Hit.h"
 #include <Eigen/Core>
+#include <limits>
 #include <memory>
+#include <unordered_map>
 
 struct Ray;
+class Object;
+// Single precision copies of objects by original (see
+// Object::single_precision_copy)
+typedef std::unordered_map<const Object *, std::shared_ptr<Object> >
+  SinglePrecisionCopies;
 class Object
 {
   public:
@@ -25,6 +34,127 @@ class Object
     // The funny = 0 just ensures that this function is defined (as a no-op)
     virtual bool intersect(
         const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const = 0;
+    // Find the first hit of a ray in a parametric interval without computing
+    // any shading attributes. Callers that keep the closest of several
+    // candidates pass their current best as max_t, so farther hits are
+    // rejected early, and only ask for the normal of the final hit.
+    //
+    // Inputs:
+    //   ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider (exclusive; may be
+    //     infinite)
+    // Outputs:
+    //   hit  first hit in [min_t,max_t) (see surface_normal)
+    // Returns true iff intersect would find a hit with t < max_t
+    virtual bool intersect_hit(
+        const Ray & ray,
+        const double min_t,
+        const double max_t,
+        Hit & hit) const = 0;
+    // Unit surface normal at a hit reported by intersect_hit.
+    //
+    // Inputs:
+    //   ray  ray passed to intersect_hit
+    //   hit  hit reported by intersect_hit
+    // Returns surface normal at ray.origin + hit.t * ray.direction
+    virtual Eigen::Vector3d surface_normal(
+        const Ray & ray, const Hit & hit) const = 0;
+    // Intersect object with ray, also reporting which of its parts was hit.
+    // Objects that group primitives with their own materials (e.g.,
+    // SphereSet) report the part through intersect_hit; everything else is a
+    // single part 0.
+    //
+    // Inputs:
+    //   Ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    // Outputs:
+    //   t  first intersection at ray.origin + t * ray.direction
+    //   n  surface normal at point of intersection
+    //   part  index of the part hit (see part_material)
+    // Returns iff there a first intersection is found.
+    bool intersect_part(
+        const Ray & ray,
+        const double min_t,
+        double & t,
+        Eigen::Vector3d & n,
+        int & part) const
+    {
+      Hit hit;
+      if (!intersect_hit(
+            ray, min_t, std::numeric_limits<double>::infinity(), hit)) {
+        return false;
+      }
+      t = hit.t;
+      n = surface_normal(ray, hit);
+      part = hit.part;
+      return true;
+    }
+    // Material of a part reported by intersect_part
+    virtual const Material & part_material(const int part) const
+    {
+      (void) part;
+      return *material;
+    }
+    // Returns number of parts (parts are numbered 0 to num_parts()-1)
+    virtual int num_parts() const { return 1; }
+    // Determine whether the object blocks a ray anywhere in a parametric
+    // interval. Cheaper than intersect: it may stop at the first blocker and
+    // never computes a normal. Used for shadow rays.
+    //
+    // Inputs:
+    //   ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider (exclusive)
+    // Returns true iff intersect would find a hit with t < max_t
+    virtual bool occluded(
+        const Ray & ray, const double min_t, const double max_t) const = 0;
+    // Axis-aligned bounding box of the object.
+    //
+    // Outputs:
+    //   box  box containing every point the object can be hit at
+    // Returns false iff the object is unbounded (e.g., a plane), in which case
+    // acceleration structures must test it against every ray.
+    virtual bool bounding_box(AABB & box) const { (void) box; return false; }
+    // Copy of the object that stores and traverses its acceleration
+    // structures in single precision, leaving this object (and any scene
+    // compiled from it in double) alone. Single precision only culls;
+    // candidates are still decided in double, so hits do not change. The
+    // copy reads the primitives of this object instead of duplicating them,
+    // so this object must outlive it.
+    //
+    // Inputs:
+    //   copies  copies made so far by original object, so that an object
+    //     placed several times is copied once (see single_precision_object)
+    // Returns the copy, or nullptr if the object has no acceleration
+    //   structures (it is then used as it is)
+    virtual std::shared_ptr<Object> single_precision_copy(
+        SinglePrecisionCopies & copies) const
+    {
+      (void) copies;
+      return nullptr;
+    }
 };
 
+// Single precision form of an object (see Object::single_precision_copy):
+// its copy, made on first use, or the object itself if it needs none.
+//
+// Inputs:
+//   object  object to convert
+//   copies  copies made so far by original object
+// Outputs:
+//   copies  copies with object's added
+// Returns object to use in single precision
+inline std::shared_ptr<Object> single_precision_object(
+  const std::shared_ptr<Object> & object,
+  SinglePrecisionCopies & copies)
+{
+  const auto found = copies.find(object.get());
+  if(found != copies.end()) return found->second;
+  std::shared_ptr<Object> copy = object->single_precision_copy(copies);
+  if(!copy) copy = object;
+  copies[object.get()] = copy;
+  return copy;
+}
+
 #endif
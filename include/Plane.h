@@ -22,6 +22,23 @@ class Plane : public Object
   // Returns iff there a first intersection is found.
   bool intersect(
     const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const;
+  // Intersect plane with ray in [min_t,max_t) (see Object::intersect_hit).
+  bool intersect_hit(
+    const Ray & ray,
+    const double min_t,
+    const double max_t,
+    Hit & hit) const;
+  // Returns unit normal of the plane
+  Eigen::Vector3d surface_normal(const Ray & ray, const Hit & hit) const;
+  // Determine whether the plane blocks a ray in [min_t,max_t).
+  //
+  // Inputs:
+  //   ray  ray to intersect with
+  //   min_t  minimum parametric distance to consider
+  //   max_t  maximum parametric distance to consider (exclusive)
+  // Returns true iff intersect would find a hit with t < max_t
+  bool occluded(
+    const Ray & ray, const double min_t, const double max_t) const;
 };
 
 #endif
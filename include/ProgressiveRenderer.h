@@ -0,0 +1,137 @@
+#ifndef PROGRESSIVERENDERER_H
+#define PROGRESSIVERENDERER_H
+
+#include "Object.h"
+#include "Camera.h"
+#include "Light.h"
+#include "CompiledScene.h"
+#include "ThreadPool.h"
+#include "render_image.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Renders a scene in the background for the interactive viewer, one sample
+// per pixel per pass, adding every finished tile into a running sum so the
+// display can show the current estimate at any time. restart() discards the
+// sum and starts over with a new camera or settings; tiles of the old frame
+// still in flight are abandoned within one tile (about a millisecond) and
+// never reach the new sum. Samples use the same (seed, i, j, s) random
+// numbers as render_image, so the converged image is the same frame.
+class ProgressiveRenderer
+{
+  public:
+    // Inputs:
+    //   objects  list of objects (shapes) in the scene
+    //   scene  objects compiled for ray queries (see CompiledScene)
+    //   lights  list of lights in the scene
+    //   num_threads  number of render threads (<= 0 means one per hardware
+    //     thread)
+    // The scene must outlive the renderer. Nothing is rendered before the
+    // first restart().
+    ProgressiveRenderer(
+      const std::vector< std::shared_ptr<Object> > & objects,
+      const CompiledScene & scene,
+      const std::vector< std::shared_ptr<Light> > & lights,
+      const int num_threads = 0);
+    ~ProgressiveRenderer();
+    ProgressiveRenderer(const ProgressiveRenderer &) = delete;
+    ProgressiveRenderer & operator=(const ProgressiveRenderer &) = delete;
+
+    // Number of threads tracing tiles
+    int num_threads() const { return pool.size(); }
+    // Returns wall time of the last pass that was traced to the end, in
+    // seconds (0 if there is none yet)
+    double pass_seconds();
+
+    // Throw away the current frame and accumulate a new one.
+    //
+    // Inputs:
+    //   camera  Perspective camera
+    //   settings  render settings (samples_per_pixel is the number of passes
+    //     to stop after)
+    void restart(const Camera & camera, const RenderSettings & settings);
+    // Change the number of passes to stop after without discarding the
+    // samples so far (e.g., to refine a frame further).
+    //
+    // Inputs:
+    //   samples_per_pixel  new number of passes
+    void set_samples_per_pixel(const int samples_per_pixel);
+    // Stop working on the current frame as soon as possible, keeping the
+    // samples so far (e.g., while the viewer shows something else). Partly
+    // traced passes are not counted in snapshot's `samples`.
+    void cancel();
+
+    // Copy out the current estimate if it changed since the last call.
+    //
+    // Outputs:
+    //   radiance  3*width*height list of linear RGB values, row-major from
+    //     the top: the mean of the samples of each pixel so far. Pixels
+    //     without samples yet keep their values (the previous frame's while
+    //     a restarted frame fills in; black if the size changed).
+    //   depth  width*height list of depths (distance along -w from the eye)
+    //     of the first hits of each pixel's first sample (infinity where it
+    //     misses or has not been traced yet)
+    //   width  width of the frame
+    //   height  height of the frame
+    //   samples  number of passes that have been completed
+    //   done  whether the frame is finished (every pass traced, or cancelled
+    //     and nothing in flight)
+    // Returns false (and leaves the outputs alone) if nothing changed
+    bool snapshot(
+      std::vector<float> & radiance,
+      std::vector<float> & depth,
+      int & width,
+      int & height,
+      int & samples,
+      bool & done);
+
+  private:
+    // Background thread: run passes while there are any left
+    void run();
+    // Trace sample `s` of every pixel of the current frame, giving up as soon
+    // as the frame is restarted.
+    void trace_pass(
+      const Camera & camera,
+      const RenderSettings & settings,
+      const int s,
+      const unsigned pass_frame);
+
+    const std::vector< std::shared_ptr<Object> > & objects;
+    const CompiledScene & scene;
+    const std::vector< std::shared_ptr<Light> > & lights;
+    ThreadPool pool;
+
+    // Everything below is guarded by `mutex`, except that `frame` may be
+    // read without it to abandon stale tiles early
+    std::mutex mutex;
+    std::condition_variable wake;
+    Camera camera;
+    RenderSettings settings;
+    // Counts restarts; tiles of an older frame are dropped
+    std::atomic<unsigned> frame{0};
+    // Number of passes per pixel of the frame (see render_samples_per_pixel)
+    int traced_samples = 0;
+    // Next pass to start and number of passes finished
+    int next_pass = 0;
+    int passes_done = 0;
+    // Whether the background thread is in trace_pass
+    bool tracing = false;
+    double last_pass_seconds = 0.0;
+    // 3*width*height sums of samples and width*height sample counts
+    std::vector<float> sum;
+    std::vector<int> count;
+    // width*height depths of the first hits of pass 0
+    std::vector<float> first_depth;
+    // Bumped whenever sum, count or passes_done change
+    unsigned long long version = 0;
+    unsigned long long version_seen = ~0ull;
+    bool stopping = false;
+    std::thread thread;
+};
+
+#endif
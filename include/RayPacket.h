@@ -0,0 +1,96 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "Ray.h"
+#include "round_float.h"
+#include <Eigen/Core>
+#include <cstdint>
+
+// Up to SIZE rays (an 8x8 pixel block) stored structure-of-arrays so that a
+// bounding box can be tested against several of them in one SIMD pass. Rays
+// are referred to by lane, and sets of rays by bitmasks over the lanes.
+struct alignas(32) RayPacket
+{
+  static const int SIZE = 64;
+  // Number of rays in lanes [0,count)
+  int count = 0;
+  // origin[a][l] is coordinate a of the origin of the ray in lane l
+  alignas(32) double origin[3][SIZE];
+  alignas(32) double direction[3][SIZE];
+  // Componentwise inverse of direction
+  alignas(32) double inv_dir[3][SIZE];
+  // Single precision copies for the slab tests of BVH::FloatWideNode (see
+  // FloatSlabRay): the origin rounded down and up, and inv_dir rounded to
+  // nearest
+  alignas(32) float origin_lo[3][SIZE];
+  alignas(32) float origin_hi[3][SIZE];
+  alignas(32) float inv_dir_float[3][SIZE];
+
+  RayPacket()
+  {
+    for(int a = 0; a < 3; ++a)
+    {
+      for(int l = 0; l < SIZE; ++l)
+      {
+        origin[a][l] = 0.0;
+        direction[a][l] = 1.0;
+        inv_dir[a][l] = 1.0;
+        origin_lo[a][l] = origin_hi[a][l] = 0.0f;
+        inv_dir_float[a][l] = 1.0f;
+      }
+    }
+  }
+
+  // Store a ray in a lane
+  //
+  // Inputs:
+  //   lane  lane to fill (0 <= lane < SIZE)
+  //   ray  ray to store
+  void set(const int lane, const Ray & ray)
+  {
+    const Eigen::Vector3d inv = ray.direction.cwiseInverse();
+    for(int a = 0; a < 3; ++a)
+    {
+      origin[a][lane] = ray.origin(a);
+      direction[a][lane] = ray.direction(a);
+      inv_dir[a][lane] = inv(a);
+      origin_lo[a][lane] = round_down_float(ray.origin(a));
+      origin_hi[a][lane] = round_up_float(ray.origin(a));
+      inv_dir_float[a][lane] = static_cast<float>(inv(a));
+    }
+  }
+  // Returns the ray in a lane
+  Ray ray(const int lane) const
+  {
+    Ray r;
+    r.origin = Eigen::Vector3d(origin[0][lane], origin[1][lane], origin[2][lane]);
+    r.direction = Eigen::Vector3d(
+      direction[0][lane], direction[1][lane], direction[2][lane]);
+    return r;
+  }
+  // Returns bitmask of lanes [0,count)
+  std::uint64_t lanes() const
+  {
+    return count >= SIZE ? ~std::uint64_t(0) : (std::uint64_t(1) << count) - 1;
+  }
+  // Determine whether the rays are coherent enough to traverse together:
+  // their directions agree in sign on every axis, so they order the
+  // children of a node the same way and cull mostly the same boxes.
+  //
+  // Returns true iff all directions lie in one octant
+  bool coherent() const
+  {
+    for(int a = 0; a < 3; ++a)
+    {
+      int positive = 0;
+      for(int l = 0; l < count; ++l)
+      {
+        positive += direction[a][l] >= 0.0;
+      }
+      if(positive != 0 && positive != count) return false;
+    }
+    return true;
+  }
+};
+
+#endif
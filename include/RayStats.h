@@ -0,0 +1,43 @@
+#ifndef RAYSTATS_H
+#define RAYSTATS_H
+
+#include <cstdint>
+
+// Number of rays traced, by kind
+struct RayStats
+{
+  // Camera rays (raycolor calls with num_recursive_calls == 0)
+  std::uint64_t primary = 0;
+  // Shadow rays toward lights
+  std::uint64_t shadow = 0;
+  // Mirror reflection rays
+  std::uint64_t reflection = 0;
+
+  std::uint64_t total() const { return primary + shadow + reflection; }
+  RayStats & operator+=(const RayStats & other)
+  {
+    primary += other.primary;
+    shadow += other.shadow;
+    reflection += other.reflection;
+    return *this;
+  }
+  RayStats operator-(const RayStats & other) const
+  {
+    RayStats diff;
+    diff.primary = primary - other.primary;
+    diff.shadow = shadow - other.shadow;
+    diff.reflection = reflection - other.reflection;
+    return diff;
+  }
+};
+
+// Counters of the calling thread. raycolor and blinn_phong_shading increment
+// these; renderers snapshot them before and after a unit of work and add the
+// difference to their totals, so no atomics are needed on the hot path.
+inline RayStats & thread_ray_stats()
+{
+  static thread_local RayStats stats;
+  return stats;
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+
+// Sample dimensions drawn for every camera sample. Each dimension is an
+// independent uniform number, so adding a new one never changes the values
+// the others produce.
+enum SampleDimension
+{
+  // Point on the lens (viewing_ray_dof u,v)
+  SAMPLE_LENS_U = 0,
+  SAMPLE_LENS_V = 1,
+  // Position within the pixel (camera_ray jitter)
+  SAMPLE_PIXEL_X = 2,
+  SAMPLE_PIXEL_Y = 3,
+  // Russian roulette in raycolor, one dimension per mirror bounce from here on
+  SAMPLE_ROULETTE = 8
+};
+
+// Stateless counter-based random numbers for one camera sample. The value of
+// every dimension is a pure hash of (frame seed, pixel i/j, sample index,
+// dimension), so renders are bit-identical whichever thread or tile order
+// evaluates them, and there is no generator state to share or advance.
+struct Sampler
+{
+  // Hash of (seed, i, j, s); dimensions are mixed in on demand
+  std::uint64_t key;
+
+  // Inputs:
+  //   seed  frame seed
+  //   i  pixel row index
+  //   j  pixel column index
+  //   s  sample index within the pixel
+  Sampler(
+    const std::uint32_t seed,
+    const int i,
+    const int j,
+    const int s)
+  {
+    key = mix((static_cast<std::uint64_t>(seed) << 32) ^
+      static_cast<std::uint32_t>(s));
+    key = mix(key ^ ((static_cast<std::uint64_t>(static_cast<std::uint32_t>(i)) << 32) |
+      static_cast<std::uint32_t>(j)));
+  }
+
+  // Inputs:
+  //   dim  sample dimension (see SampleDimension)
+  // Returns a uniform random number in [0,1)
+  double uniform(const int dim) const
+  {
+    // Top 53 bits -> double mantissa
+    return (mix(key ^ static_cast<std::uint32_t>(dim)) >> 11) * 0x1.0p-53;
+  }
+
+  // splitmix64 finalizer: a bijective avalanche mix of 64 bits
+  static std::uint64_t mix(std::uint64_t z)
+  {
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+};
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef SPHERE_BLOCK_H
+#define SPHERE_BLOCK_H
+
+#include "Ray.h"
+#include <Eigen/Core>
+#include <cmath>
+#include <limits>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Structure-of-arrays pack of up to 4 spheres (one AVX2 register of doubles
+// per coordinate), so one ray can be tested against all of them at once.
+// Unused lanes hold a sphere of radius 0 at infinity, which never reports a
+// hit.
+struct alignas(32) SphereBlock
+{
+  static const int SIZE = 4;
+  // center[a][l] is coordinate a of the center of the sphere in lane l
+  double center[3][SIZE];
+  // Squared radius
+  double radius2[SIZE];
+  // Sphere id of each lane (-1 for unused lanes)
+  int sphere[SIZE];
+
+  SphereBlock()
+  {
+    for(int l = 0; l < SIZE; ++l)
+    {
+      for(int a = 0; a < 3; ++a)
+      {
+        center[a][l] = std::numeric_limits<double>::infinity();
+      }
+      radius2[l] = 0.0;
+      sphere[l] = -1;
+    }
+  }
+
+  // Store a sphere in a lane
+  //
+  // Inputs:
+  //   lane  lane to fill (0 <= lane < SIZE)
+  //   id  sphere id reported for hits in this lane
+  //   c  center
+  //   r  radius
+  void set(
+    const int lane,
+    const int id,
+    const Eigen::Vector3d & c,
+    const double r)
+  {
+    for(int a = 0; a < 3; ++a)
+    {
+      center[a][lane] = c(a);
+    }
+    radius2[lane] = r * r;
+    sphere[lane] = id;
+  }
+};
+
+// Intersect a ray with every sphere of a block. Gives exactly the same hits
+// as Sphere::intersect/occluded on each lane (the same double precision
+// operations in the same order, without fused multiply-adds; the build turns
+// off contraction so the compiler does not fuse either path).
+//
+// Inputs:
+//   ray  ray to intersect with
+//   block  spheres to intersect
+//   min_t  minimum parametric distance to consider
+//   max_t  maximum parametric distance to consider (exclusive)
+// Outputs:
+//   t  SIZE list of parametric distances of the first root past min_t
+//     (valid for lanes that hit)
+// Returns bitmask of lanes that hit in (min_t,max_t)
+inline int ray_intersect_sphere_block(
+  const Ray & ray,
+  const SphereBlock & block,
+  const double min_t,
+  const double max_t,
+  double * t)
+{
+  const Eigen::Vector3d & d = ray.direction;
+  // Same for every lane
+  const double a = d.dot(d);
+  const double two_a = 2.0 * a;
+  const double four_a = 4.0 * a;
+  const double t_lo = min_t + 1e-9;
+#ifdef __AVX2__
+  const __m256d dx = _mm256_set1_pd(d(0));
+  const __m256d dy = _mm256_set1_pd(d(1));
+  const __m256d dz = _mm256_set1_pd(d(2));
+  const __m256d ocx = _mm256_sub_pd(
+    _mm256_set1_pd(ray.origin(0)), _mm256_load_pd(block.center[0]));
+  const __m256d ocy = _mm256_sub_pd(
+    _mm256_set1_pd(ray.origin(1)), _mm256_load_pd(block.center[1]));
+  const __m256d ocz = _mm256_sub_pd(
+    _mm256_set1_pd(ray.origin(2)), _mm256_load_pd(block.center[2]));
+  const __m256d oc_d = _mm256_add_pd(
+    _mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)),
+    _mm256_mul_pd(ocz, dz));
+  const __m256d oc_oc = _mm256_add_pd(
+    _mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)),
+    _mm256_mul_pd(ocz, ocz));
+  const __m256d b = _mm256_mul_pd(_mm256_set1_pd(2.0), oc_d);
+  const __m256d c = _mm256_sub_pd(oc_oc, _mm256_load_pd(block.radius2));
+  const __m256d disc = _mm256_sub_pd(
+    _mm256_mul_pd(b, b), _mm256_mul_pd(_mm256_set1_pd(four_a), c));
+  // Keep NaN discriminants like the scalar code (they fail below)
+  const __m256d real = _mm256_cmp_pd(disc, _mm256_setzero_pd(), _CMP_NLT_UQ);
+  const __m256d sqrt_disc = _mm256_sqrt_pd(disc);
+  const __m256d neg_b = _mm256_xor_pd(b, _mm256_set1_pd(-0.0));
+  const __m256d den = _mm256_set1_pd(two_a);
+  const __m256d t0 = _mm256_div_pd(_mm256_sub_pd(neg_b, sqrt_disc), den);
+  const __m256d t1 = _mm256_div_pd(_mm256_add_pd(neg_b, sqrt_disc), den);
+  const __m256d lo = _mm256_set1_pd(t_lo);
+  const __m256d use0 = _mm256_cmp_pd(t0, lo, _CMP_GE_OQ);
+  const __m256d use1 = _mm256_cmp_pd(t1, lo, _CMP_GE_OQ);
+  const __m256d tt = _mm256_blendv_pd(t1, t0, use0);
+  __m256d mask = _mm256_and_pd(real, _mm256_or_pd(use0, use1));
+  mask = _mm256_and_pd(
+    mask, _mm256_cmp_pd(tt, _mm256_set1_pd(max_t), _CMP_LT_OQ));
+  _mm256_storeu_pd(t, tt);
+  return _mm256_movemask_pd(mask);
+#else
+  // Same operations lane by lane, written as straight loops over the lanes so
+  // the compiler can vectorize them with whatever SIMD it targets
+  int hits = 0;
+  for(int l = 0; l < SphereBlock::SIZE; ++l)
+  {
+    const double ocx = ray.origin(0) - block.center[0][l];
+    const double ocy = ray.origin(1) - block.center[1][l];
+    const double ocz = ray.origin(2) - block.center[2][l];
+    const double b = 2.0 * (ocx * d(0) + ocy * d(1) + ocz * d(2));
+    const double c = (ocx * ocx + ocy * ocy + ocz * ocz) - block.radius2[l];
+    const double disc = b * b - four_a * c;
+    const double sqrt_disc = std::sqrt(disc);
+    const double t0 = (-b - sqrt_disc) / two_a;
+    const double t1 = (-b + sqrt_disc) / two_a;
+    const bool use0 = t0 >= t_lo;
+    const double tt = use0 ? t0 : t1;
+    t[l] = tt;
+    const bool hit = !(disc < 0.0) && (use0 || t1 >= t_lo) && tt < max_t;
+    hits |= static_cast<int>(hit) << l;
+  }
+  return hits;
+#endif
+}
+
+#endif
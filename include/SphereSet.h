@@ -0,0 +1,111 @@
+#ifndef SPHERE_SET_H
+#define SPHERE_SET_H
+
+#include "Object.h"
+#include "BVH.h"
+#include "SphereBlock.h"
+#include <Eigen/Core>
+#include <memory>
+#include <vector>
+
+// Many spheres intersected as one object. Each sphere keeps its own material
+// (reported through intersect_hit/part_material), so a run of spheres from a
+// scene file can be replaced by a SphereSet without changing the image. For
+// ray queries the spheres of each BVH leaf are packed into SphereBlocks and
+// tested a block at a time.
+class SphereSet : public Object
+{
+  public:
+    // #S list of sphere centers (this list, the radii, materials and blocks
+    // are empty in a single precision copy, which reads those of spheres())
+    std::vector<Eigen::Vector3d> centers;
+    // #S list of sphere radii
+    std::vector<double> radii;
+    // #S list of sphere materials
+    std::vector<std::shared_ptr<Material> > materials;
+    // Hierarchy over the spheres, built once they are added with build_bvh().
+    // If empty, every sphere is tested.
+    BVH bvh;
+    // Spheres of each BVH leaf packed into SIMD blocks (by build_bvh): leaf
+    // node k owns blocks leaf_blocks[k] up to leaf_blocks[k] +
+    // ceil(count/SphereBlock::SIZE)
+    std::vector<SphereBlock> blocks;
+    std::vector<int> leaf_blocks;
+
+    // Returns the set holding the spheres and their blocks: the one a single
+    // precision copy was made from, otherwise this one
+    const SphereSet & spheres() const { return source ? *source : *this; }
+    // Returns number of spheres
+    int num_spheres() const
+    {
+      return static_cast<int>(spheres().centers.size());
+    }
+    // Append a sphere
+    //
+    // Inputs:
+    //   center  center of the sphere
+    //   radius  radius of the sphere
+    //   material  material of the sphere
+    void add(
+      const Eigen::Vector3d & center,
+      const double radius,
+      const std::shared_ptr<Material> & material);
+    // Build `bvh` over the spheres and pack its leaves into `blocks`
+    void build_bvh();
+    // Copy of the set that traverses its BVH in single precision (see
+    // Object::single_precision_copy); the spheres themselves stay in double
+    // and are read from this set, so the copy only adds its BVH. Hits do not
+    // change.
+    std::shared_ptr<Object> single_precision_copy(
+      SinglePrecisionCopies & copies) const;
+
+    // Intersect the spheres with ray.
+    //
+    // Inputs:
+    //   Ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    // Outputs:
+    //   t  first intersection at ray.origin + t * ray.direction
+    //   n  surface normal at point of intersection
+    // Returns iff there a first intersection is found.
+    bool intersect(
+      const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const;
+    // Find the first sphere hit in [min_t,max_t) (see
+    // Object::intersect_hit).
+    //
+    // Outputs:
+    //   hit  hit.part and hit.primitive are the index of the sphere hit (ties
+    //     go to the lower index)
+    bool intersect_hit(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      Hit & hit) const;
+    // Returns unit outward normal of sphere hit.primitive at the hit
+    Eigen::Vector3d surface_normal(const Ray & ray, const Hit & hit) const;
+    // Returns material of sphere `part`
+    const Material & part_material(const int part) const;
+    // Returns number of spheres (one part each)
+    int num_parts() const { return num_spheres(); }
+    // Determine whether any sphere blocks a ray in [min_t,max_t).
+    //
+    // Inputs:
+    //   ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider (exclusive)
+    // Returns true iff intersect would find a hit with t < max_t
+    bool occluded(
+      const Ray & ray, const double min_t, const double max_t) const;
+    // Axis-aligned bounding box of the spheres.
+    //
+    // Outputs:
+    //   box  tight box around all spheres
+    // Returns false iff the set is empty
+    bool bounding_box(AABB & box) const;
+
+  private:
+    // Set whose spheres a single precision copy reads (nullptr otherwise)
+    const SphereSet * source = nullptr;
+};
+
+#endif
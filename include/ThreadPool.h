@@ -0,0 +1,66 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads that runs batches of independent tasks
+// with work stealing: each thread starts with a contiguous block of tasks in
+// its own queue and, once that runs dry, steals from the back of the other
+// queues. This keeps every core busy when some tasks (e.g., image tiles full
+// of bokeh or mirrors) are much more expensive than others.
+class ThreadPool
+{
+  public:
+    // Inputs:
+    //   num_threads  number of threads including the caller of parallel_for
+    //     (<= 0 means std::thread::hardware_concurrency())
+    explicit ThreadPool(int num_threads = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    // Number of threads that execute tasks (including the calling thread)
+    int size() const { return static_cast<int>(queues.size()); }
+
+    // Run task(k) for every k in [0,num_tasks) and wait until all are done.
+    // The calling thread works on tasks too. Not reentrant.
+    //
+    // Inputs:
+    //   num_tasks  number of tasks
+    //   task  function called once per task index (from any thread)
+    void parallel_for(
+      const int num_tasks,
+      const std::function<void(const int)> & task);
+
+  private:
+    struct Queue
+    {
+      std::mutex mutex;
+      std::deque<int> tasks;
+    };
+    // Pop from the front of our own queue or steal from the back of another.
+    // Returns false once every queue is empty.
+    bool next_task(const int thread_id, int & task_id);
+    // Execute tasks until none are left
+    void work(const int thread_id);
+    void worker_loop(const int thread_id);
+
+    std::vector<std::unique_ptr<Queue> > queues;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    const std::function<void(const int)> * current_task = nullptr;
+    std::atomic<int> pending{0};
+    unsigned long long generation = 0;
+    bool stopping = false;
+};
+
+#endif
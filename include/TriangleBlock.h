@@ -0,0 +1,461 @@
+#ifndef TRIANGLE_BLOCK_H
+#define TRIANGLE_BLOCK_H
+
+#include "Ray.h"
+#include "ray_intersect_triangle.h"
+#include <Eigen/Core>
+#include <cmath>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// Structure-of-arrays pack of up to 4 triangles (one AVX2 register of
+// doubles per coordinate) with their edges precomputed, so one ray can be
+// tested against all of them at once. Unused lanes hold a degenerate
+// triangle, which never reports a hit.
+struct alignas(32) TriangleBlock
+{
+  static const int SIZE = 4;
+  // v0[a][l] is coordinate a of the first corner of the triangle in lane l
+  double v0[3][SIZE];
+  // Second corner minus first corner
+  double e1[3][SIZE];
+  // Third corner minus first corner
+  double e2[3][SIZE];
+  // Face id of each lane (-1 for unused lanes)
+  int face[SIZE];
+
+  TriangleBlock()
+  {
+    for(int a = 0; a < 3; ++a)
+    {
+      for(int l = 0; l < SIZE; ++l)
+      {
+        v0[a][l] = e1[a][l] = e2[a][l] = 0.0;
+      }
+    }
+    for(int l = 0; l < SIZE; ++l) face[l] = -1;
+  }
+
+  // Store a triangle in a lane
+  //
+  // Inputs:
+  //   lane  lane to fill (0 <= lane < SIZE)
+  //   id  face id reported for hits in this lane
+  //   a  first corner
+  //   b  second corner
+  //   c  third corner
+  void set(
+    const int lane,
+    const int id,
+    const Eigen::Vector3d & a,
+    const Eigen::Vector3d & b,
+    const Eigen::Vector3d & c)
+  {
+    const Eigen::Vector3d ab = b - a;
+    const Eigen::Vector3d ac = c - a;
+    for(int k = 0; k < 3; ++k)
+    {
+      v0[k][lane] = a(k);
+      e1[k][lane] = ab(k);
+      e2[k][lane] = ac(k);
+    }
+    face[lane] = id;
+  }
+};
+
+// Intersect a ray with every triangle of a block. Gives exactly the same
+// hits as ray_intersect_triangle_edges on each lane (the vector path performs
+// the same double precision operations in the same order).
+//
+// Inputs:
+//   ray  ray to intersect with
+//   block  triangles to intersect
+//   min_t  minimum parametric distance to consider
+//   max_t  maximum parametric distance to consider (exclusive)
+// Outputs:
+//   t  SIZE list of parametric distances (valid for lanes that hit)
+// Returns bitmask of lanes that hit in (min_t,max_t)
+inline int ray_intersect_triangle_block(
+  const Ray & ray,
+  const TriangleBlock & block,
+  const double min_t,
+  const double max_t,
+  double * t)
+{
+#ifdef __AVX2__
+  const __m256d dx = _mm256_set1_pd(ray.direction(0));
+  const __m256d dy = _mm256_set1_pd(ray.direction(1));
+  const __m256d dz = _mm256_set1_pd(ray.direction(2));
+  const __m256d e1x = _mm256_load_pd(block.e1[0]);
+  const __m256d e1y = _mm256_load_pd(block.e1[1]);
+  const __m256d e1z = _mm256_load_pd(block.e1[2]);
+  const __m256d e2x = _mm256_load_pd(block.e2[0]);
+  const __m256d e2y = _mm256_load_pd(block.e2[1]);
+  const __m256d e2z = _mm256_load_pd(block.e2[2]);
+  // No fused multiply-adds (and the build turns off contraction, see
+  // CMakeLists.txt): results must match the scalar path bit for bit
+  auto cross = [](
+    const __m256d ax, const __m256d ay, const __m256d az,
+    const __m256d bx, const __m256d by, const __m256d bz,
+    __m256d & cx, __m256d & cy, __m256d & cz)
+  {
+    cx = _mm256_sub_pd(_mm256_mul_pd(ay, bz), _mm256_mul_pd(az, by));
+    cy = _mm256_sub_pd(_mm256_mul_pd(az, bx), _mm256_mul_pd(ax, bz));
+    cz = _mm256_sub_pd(_mm256_mul_pd(ax, by), _mm256_mul_pd(ay, bx));
+  };
+  auto dot = [](
+    const __m256d ax, const __m256d ay, const __m256d az,
+    const __m256d bx, const __m256d by, const __m256d bz)
+  {
+    return _mm256_add_pd(
+      _mm256_add_pd(_mm256_mul_pd(ax, bx), _mm256_mul_pd(ay, by)),
+      _mm256_mul_pd(az, bz));
+  };
+
+  __m256d px, py, pz;
+  cross(dx, dy, dz, e2x, e2y, e2z, px, py, pz);
+  const __m256d det = dot(e1x, e1y, e1z, px, py, pz);
+
+  // Each test keeps the lanes the scalar code would not reject (so NaNs
+  // survive until the final t comparison, as they do there)
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d abs_det = _mm256_andnot_pd(_mm256_set1_pd(-0.0), det);
+  __m256d mask = _mm256_cmp_pd(abs_det, _mm256_set1_pd(1e-9), _CMP_NLT_UQ);
+
+  const __m256d inv_det = _mm256_div_pd(one, det);
+  const __m256d tx = _mm256_sub_pd(
+    _mm256_set1_pd(ray.origin(0)), _mm256_load_pd(block.v0[0]));
+  const __m256d ty = _mm256_sub_pd(
+    _mm256_set1_pd(ray.origin(1)), _mm256_load_pd(block.v0[1]));
+  const __m256d tz = _mm256_sub_pd(
+    _mm256_set1_pd(ray.origin(2)), _mm256_load_pd(block.v0[2]));
+  const __m256d u = _mm256_mul_pd(dot(tx, ty, tz, px, py, pz), inv_det);
+  mask = _mm256_and_pd(mask, _mm256_cmp_pd(u, zero, _CMP_NLT_UQ));
+  mask = _mm256_and_pd(mask, _mm256_cmp_pd(u, one, _CMP_NGT_UQ));
+
+  __m256d qx, qy, qz;
+  cross(tx, ty, tz, e1x, e1y, e1z, qx, qy, qz);
+  const __m256d v = _mm256_mul_pd(dot(dx, dy, dz, qx, qy, qz), inv_det);
+  mask = _mm256_and_pd(mask, _mm256_cmp_pd(v, zero, _CMP_NLT_UQ));
+  mask = _mm256_and_pd(
+    mask, _mm256_cmp_pd(_mm256_add_pd(u, v), one, _CMP_NGT_UQ));
+
+  const __m256d tt = _mm256_mul_pd(dot(e2x, e2y, e2z, qx, qy, qz), inv_det);
+  mask = _mm256_and_pd(
+    mask, _mm256_cmp_pd(tt, _mm256_set1_pd(min_t + 1e-9), _CMP_GE_OQ));
+  mask = _mm256_and_pd(
+    mask, _mm256_cmp_pd(tt, _mm256_set1_pd(max_t), _CMP_LT_OQ));
+
+  _mm256_storeu_pd(t, tt);
+  return _mm256_movemask_pd(mask);
+#else
+  // Same operations lane by lane, written as straight loops over the lanes so
+  // the compiler can vectorize them with whatever SIMD it targets
+  const int N = TriangleBlock::SIZE;
+  const double * e1x = block.e1[0];
+  const double * e1y = block.e1[1];
+  const double * e1z = block.e1[2];
+  const double * e2x = block.e2[0];
+  const double * e2y = block.e2[1];
+  const double * e2z = block.e2[2];
+  const double dx = ray.direction(0);
+  const double dy = ray.direction(1);
+  const double dz = ray.direction(2);
+  const double t_lo = min_t + 1e-9;
+  int hits = 0;
+  for(int l = 0; l < N; ++l)
+  {
+    const double px = dy * e2z[l] - dz * e2y[l];
+    const double py = dz * e2x[l] - dx * e2z[l];
+    const double pz = dx * e2y[l] - dy * e2x[l];
+    const double det = e1x[l] * px + e1y[l] * py + e1z[l] * pz;
+    const double inv_det = 1.0 / det;
+    const double tx = ray.origin(0) - block.v0[0][l];
+    const double ty = ray.origin(1) - block.v0[1][l];
+    const double tz = ray.origin(2) - block.v0[2][l];
+    const double u = (tx * px + ty * py + tz * pz) * inv_det;
+    const double qx = ty * e1z[l] - tz * e1y[l];
+    const double qy = tz * e1x[l] - tx * e1z[l];
+    const double qz = tx * e1y[l] - ty * e1x[l];
+    const double v = (dx * qx + dy * qy + dz * qz) * inv_det;
+    const double tt = (e2x[l] * qx + e2y[l] * qy + e2z[l] * qz) * inv_det;
+    t[l] = tt;
+    const bool hit =
+      !(std::abs(det) < 1e-9) &&
+      !(u < 0.0 || u > 1.0) &&
+      !(v < 0.0 || u + v > 1.0) &&
+      tt >= t_lo && tt < max_t;
+    hits |= static_cast<int>(hit) << l;
+  }
+  return hits;
+#endif
+}
+
+// Single precision pack of up to 8 triangles (one AVX2 register of floats per
+// coordinate): 52 bytes per face against a TriangleBlock's 80 and twice the
+// lanes per instruction. Too coarse to decide hits on its own; it culls the
+// faces a ray surely misses (see ray_triangle_block_candidates) and the rest
+// are decided in double.
+struct alignas(32) FloatTriangleBlock
+{
+  static const int SIZE = 8;
+  // As in TriangleBlock, rounded to nearest
+  float v0[3][SIZE];
+  float e1[3][SIZE];
+  float e2[3][SIZE];
+  // Sum of absolute coordinates of e1 and e2 (for the error bounds)
+  float e1_norm[SIZE];
+  float e2_norm[SIZE];
+  // Face id of each lane (-1 for unused lanes)
+  int face[SIZE];
+  // Lanes [0,count) are used
+  int count = 0;
+
+  FloatTriangleBlock()
+  {
+    for(int a = 0; a < 3; ++a)
+    {
+      for(int l = 0; l < SIZE; ++l)
+      {
+        v0[a][l] = e1[a][l] = e2[a][l] = 0.0f;
+      }
+    }
+    for(int l = 0; l < SIZE; ++l)
+    {
+      e1_norm[l] = e2_norm[l] = 0.0f;
+      face[l] = -1;
+    }
+  }
+
+  // Store a triangle in the next lane
+  //
+  // Inputs:
+  //   id  face id reported for hits in this lane
+  //   a  first corner
+  //   b  second corner
+  //   c  third corner
+  void push(
+    const int id,
+    const Eigen::Vector3d & a,
+    const Eigen::Vector3d & b,
+    const Eigen::Vector3d & c)
+  {
+    const Eigen::Vector3d ab = b - a;
+    const Eigen::Vector3d ac = c - a;
+    for(int k = 0; k < 3; ++k)
+    {
+      v0[k][count] = static_cast<float>(a(k));
+      e1[k][count] = static_cast<float>(ab(k));
+      e2[k][count] = static_cast<float>(ac(k));
+    }
+    e1_norm[count] = static_cast<float>(ab.cwiseAbs().sum());
+    e2_norm[count] = static_cast<float>(ac.cwiseAbs().sum());
+    face[count] = id;
+    count++;
+  }
+};
+
+// A ray rounded to single precision for ray_triangle_block_candidates
+struct FloatTriangleRay
+{
+  float origin[3];
+  float direction[3];
+  // Sums of absolute coordinates of origin and direction
+  float origin_norm;
+  float direction_norm;
+
+  FloatTriangleRay(const Ray & ray)
+  {
+    for(int a = 0; a < 3; ++a)
+    {
+      origin[a] = static_cast<float>(ray.origin(a));
+      direction[a] = static_cast<float>(ray.direction(a));
+    }
+    origin_norm = static_cast<float>(ray.origin.cwiseAbs().sum());
+    direction_norm = static_cast<float>(ray.direction.cwiseAbs().sum());
+  }
+};
+
+// Unit roundoff of single precision (half the gap between 1 and the next
+// float)
+const float FLOAT_UNIT_ROUNDOFF = std::numeric_limits<float>::epsilon() / 2;
+// Relative error bound of the single precision triangle test. Each of det
+// and the u, v and t numerators is a triple product a.(b x c) of the ray and
+// edge vectors, and ray_triangle_block_candidates bounds its error by
+// FLOAT_TRIANGLE_TOLERANCE * |a|*|b|*|c| (absolute sums). To first order in
+// the unit roundoff u, the error of a triple product is at most
+//   u per vector (d, e1, e2) rounded to float, and 2u for origin - v0
+//     against |origin - v0| + |origin| (both operands and the difference
+//     are rounded): at most 4u over the three vectors
+//   + 2u for the cross product (a product and a difference per coordinate)
+//   + 3u for the dot product (three products, two sums)
+// times |a|*|b|*|c|, and forming the compared quantities (u + v, the bounds
+// t_lo*|det| and t_hi*|det|, the error terms themselves) adds up to about 4u
+// more: 13u in all. The tolerance is 256u (about 1.5e-5), over an order of
+// magnitude more, which covers the dropped second order terms and the
+// rounded norms; a wider bound only passes more candidates to the double
+// test.
+const float FLOAT_TRIANGLE_TOLERANCE = 256 * FLOAT_UNIT_ROUNDOFF;
+
+// Find the triangles of a block that a ray may hit in [min_t,max_t). Runs the
+// Moller-Trumbore test of ray_intersect_triangle_edges in single precision,
+// but keeps every lane whose barycentric or distance tests are within the
+// error bound of passing (and every lane whose determinant is too small to
+// trust), so every lane the double test reports a hit for is kept. Callers
+// decide the kept lanes with ray_intersect_triangle_edges.
+//
+// Inputs:
+//   ray  ray rounded to single precision
+//   block  triangles to intersect
+//   min_t  minimum parametric distance to consider
+//   max_t  maximum parametric distance to consider (exclusive)
+// Returns bitmask of lanes that may hit in (min_t,max_t)
+inline int ray_triangle_block_candidates(
+  const FloatTriangleRay & ray,
+  const FloatTriangleBlock & block,
+  const double min_t,
+  const double max_t)
+{
+  const int valid = (1 << block.count) - 1;
+  // Bounds on t * det are scaled by the extreme values of |det|, so they
+  // need the sign of min_t
+  const float t_lo = static_cast<float>(min_t);
+  const float t_hi = static_cast<float>(max_t);
+#ifdef __AVX2__
+  const __m256 dx = _mm256_set1_ps(ray.direction[0]);
+  const __m256 dy = _mm256_set1_ps(ray.direction[1]);
+  const __m256 dz = _mm256_set1_ps(ray.direction[2]);
+  const __m256 e1x = _mm256_load_ps(block.e1[0]);
+  const __m256 e1y = _mm256_load_ps(block.e1[1]);
+  const __m256 e1z = _mm256_load_ps(block.e1[2]);
+  const __m256 e2x = _mm256_load_ps(block.e2[0]);
+  const __m256 e2y = _mm256_load_ps(block.e2[1]);
+  const __m256 e2z = _mm256_load_ps(block.e2[2]);
+  auto cross = [](
+    const __m256 ax, const __m256 ay, const __m256 az,
+    const __m256 bx, const __m256 by, const __m256 bz,
+    __m256 & cx, __m256 & cy, __m256 & cz)
+  {
+    cx = _mm256_sub_ps(_mm256_mul_ps(ay, bz), _mm256_mul_ps(az, by));
+    cy = _mm256_sub_ps(_mm256_mul_ps(az, bx), _mm256_mul_ps(ax, bz));
+    cz = _mm256_sub_ps(_mm256_mul_ps(ax, by), _mm256_mul_ps(ay, bx));
+  };
+  auto dot = [](
+    const __m256 ax, const __m256 ay, const __m256 az,
+    const __m256 bx, const __m256 by, const __m256 bz)
+  {
+    return _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)),
+      _mm256_mul_ps(az, bz));
+  };
+  const __m256 sign_bit = _mm256_set1_ps(-0.0f);
+  auto abs_ps = [&](const __m256 a) { return _mm256_andnot_ps(sign_bit, a); };
+
+  __m256 px, py, pz;
+  cross(dx, dy, dz, e2x, e2y, e2z, px, py, pz);
+  const __m256 det = dot(e1x, e1y, e1z, px, py, pz);
+  const __m256 tx = _mm256_sub_ps(
+    _mm256_set1_ps(ray.origin[0]), _mm256_load_ps(block.v0[0]));
+  const __m256 ty = _mm256_sub_ps(
+    _mm256_set1_ps(ray.origin[1]), _mm256_load_ps(block.v0[1]));
+  const __m256 tz = _mm256_sub_ps(
+    _mm256_set1_ps(ray.origin[2]), _mm256_load_ps(block.v0[2]));
+  __m256 qx, qy, qz;
+  cross(tx, ty, tz, e1x, e1y, e1z, qx, qy, qz);
+  // Numerators of u, v and t, with the sign of det folded in
+  const __m256 det_sign = _mm256_and_ps(det, sign_bit);
+  const __m256 u = _mm256_xor_ps(dot(tx, ty, tz, px, py, pz), det_sign);
+  const __m256 v = _mm256_xor_ps(dot(dx, dy, dz, qx, qy, qz), det_sign);
+  const __m256 t = _mm256_xor_ps(dot(e2x, e2y, e2z, qx, qy, qz), det_sign);
+
+  // Error bounds (the origin's rounding error is bounded by its size)
+  const __m256 tol = _mm256_set1_ps(FLOAT_TRIANGLE_TOLERANCE);
+  const __m256 t_norm = _mm256_add_ps(
+    _mm256_add_ps(_mm256_add_ps(abs_ps(tx), abs_ps(ty)), abs_ps(tz)),
+    _mm256_set1_ps(ray.origin_norm));
+  const __m256 d_norm = _mm256_set1_ps(ray.direction_norm);
+  const __m256 e1_norm = _mm256_load_ps(block.e1_norm);
+  const __m256 e2_norm = _mm256_load_ps(block.e2_norm);
+  const __m256 d_e1 = _mm256_mul_ps(tol, _mm256_mul_ps(d_norm, e1_norm));
+  const __m256 t_e1 = _mm256_mul_ps(tol, _mm256_mul_ps(t_norm, e1_norm));
+  const __m256 t_d = _mm256_mul_ps(tol, _mm256_mul_ps(t_norm, d_norm));
+  const __m256 det_err = _mm256_mul_ps(d_e1, e2_norm);
+  const __m256 u_err = _mm256_mul_ps(t_d, e2_norm);
+  const __m256 v_err = _mm256_mul_ps(t_e1, d_norm);
+  const __m256 t_err = _mm256_mul_ps(t_e1, e2_norm);
+
+  const __m256 abs_det = abs_ps(det);
+  const __m256 det_max = _mm256_add_ps(abs_det, det_err);
+  const __m256 det_min = _mm256_sub_ps(abs_det, det_err);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 uncertain = _mm256_cmp_ps(abs_det, det_err, _CMP_LE_OQ);
+  __m256 keep = _mm256_cmp_ps(_mm256_add_ps(u, u_err), zero, _CMP_GE_OQ);
+  keep = _mm256_and_ps(keep,
+    _mm256_cmp_ps(_mm256_add_ps(v, v_err), zero, _CMP_GE_OQ));
+  keep = _mm256_and_ps(keep,
+    _mm256_cmp_ps(_mm256_sub_ps(u, u_err), det_max, _CMP_LE_OQ));
+  keep = _mm256_and_ps(keep, _mm256_cmp_ps(
+    _mm256_sub_ps(_mm256_add_ps(u, v), _mm256_add_ps(u_err, v_err)),
+    det_max, _CMP_LE_OQ));
+  keep = _mm256_and_ps(keep, _mm256_cmp_ps(
+    _mm256_add_ps(t, t_err),
+    _mm256_mul_ps(_mm256_set1_ps(t_lo), t_lo >= 0.0f ? det_min : det_max),
+    _CMP_GE_OQ));
+  keep = _mm256_and_ps(keep, _mm256_cmp_ps(
+    _mm256_sub_ps(t, t_err),
+    _mm256_mul_ps(_mm256_set1_ps(t_hi), det_max), _CMP_LT_OQ));
+  return valid & _mm256_movemask_ps(_mm256_or_ps(uncertain, keep));
+#else
+  const int N = FloatTriangleBlock::SIZE;
+  const float dx = ray.direction[0];
+  const float dy = ray.direction[1];
+  const float dz = ray.direction[2];
+  const float tol = FLOAT_TRIANGLE_TOLERANCE;
+  int candidates = 0;
+  for(int l = 0; l < N; ++l)
+  {
+    const float e1x = block.e1[0][l], e1y = block.e1[1][l], e1z = block.e1[2][l];
+    const float e2x = block.e2[0][l], e2y = block.e2[1][l], e2z = block.e2[2][l];
+    const float px = dy * e2z - dz * e2y;
+    const float py = dz * e2x - dx * e2z;
+    const float pz = dx * e2y - dy * e2x;
+    const float det = e1x * px + e1y * py + e1z * pz;
+    const float tx = ray.origin[0] - block.v0[0][l];
+    const float ty = ray.origin[1] - block.v0[1][l];
+    const float tz = ray.origin[2] - block.v0[2][l];
+    const float qx = ty * e1z - tz * e1y;
+    const float qy = tz * e1x - tx * e1z;
+    const float qz = tx * e1y - ty * e1x;
+    const float s = det < 0.0f ? -1.0f : 1.0f;
+    const float u = s * (tx * px + ty * py + tz * pz);
+    const float v = s * (dx * qx + dy * qy + dz * qz);
+    const float t = s * (e2x * qx + e2y * qy + e2z * qz);
+
+    const float t_norm =
+      std::abs(tx) + std::abs(ty) + std::abs(tz) + ray.origin_norm;
+    const float d_e1 = tol * (ray.direction_norm * block.e1_norm[l]);
+    const float t_e1 = tol * (t_norm * block.e1_norm[l]);
+    const float det_err = d_e1 * block.e2_norm[l];
+    const float u_err = tol * (t_norm * ray.direction_norm) * block.e2_norm[l];
+    const float v_err = t_e1 * ray.direction_norm;
+    const float t_err = t_e1 * block.e2_norm[l];
+
+    const float abs_det = std::abs(det);
+    const float det_max = abs_det + det_err;
+    const float det_min = abs_det - det_err;
+    const bool keep =
+      u + u_err >= 0.0f &&
+      v + v_err >= 0.0f &&
+      u - u_err <= det_max &&
+      (u + v) - (u_err + v_err) <= det_max &&
+      t + t_err >= t_lo * (t_lo >= 0.0f ? det_min : det_max) &&
+      t - t_err < t_hi * det_max;
+    candidates |= static_cast<int>(abs_det <= det_err || keep) << l;
+  }
+  return valid & candidates;
+#endif
+}
+
+#endif
@@ -2,17 +2,72 @@
 #define TRIANGLE_SOUP_H
 
 #include "Object.h"
+#include "BVH.h"
+#include "TriangleBlock.h"
 #include <Eigen/Core>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
-// Forward declaration
-class Triangle;
+// Indexed triangle mesh. Faces are stored as vertex indices into one shared
+// vertex array rather than as individual Triangle objects. For ray queries
+// the faces of each BVH leaf are additionally packed into TriangleBlocks with
+// precomputed edges (or, in single precision, into FloatTriangleBlocks that
+// cull the faces a ray misses before the rest are tested in double).
+//
+// The mesh itself takes about 20 bytes per face (12 of indices, plus a
+// closed mesh's half vertex per face), but the query structures dominate:
+// for data/sakura_tree.stl the BVH takes about 70 bytes per face and the
+// TriangleBlocks about 90 (80 per full block lane; leaves are not all full),
+// so about 180 in all. A single precision copy adds about 110 more, mostly
+// its FloatTriangleBlocks.
 class TriangleSoup : public Object
 {
   public:
-    // A soup is just a set (list) of triangles
-    std::vector<std::shared_ptr<Object> > triangles;
+    // #V*3 list of vertex positions (x,y,z of vertex v at vertices[3v+0..2])
+    // (empty in a single precision copy, which reads those of mesh())
+    std::vector<float> vertices;
+    // #F*3 list of vertex indices (corners of face f at faces[3f+0..2])
+    // (likewise empty in a single precision copy)
+    std::vector<std::uint32_t> faces;
+    // Hierarchy over the faces, built once they are loaded with build_bvh().
+    // If empty, every face is tested.
+    BVH bvh;
+    // Faces of each BVH leaf packed into SIMD blocks (by build_bvh): leaf
+    // node k owns blocks leaf_blocks[k] up to leaf_blocks[k] +
+    // ceil(count/TriangleBlock::SIZE)
+    std::vector<TriangleBlock> blocks;
+    // Single precision replacement for `blocks` (in a single precision copy,
+    // see single_precision_copy), owned by leaves the same way
+    std::vector<FloatTriangleBlock> float_blocks;
+    std::vector<int> leaf_blocks;
+
+    // Returns the soup holding the vertices and faces: the one a single
+    // precision copy was made from, otherwise this one
+    const TriangleSoup & mesh() const { return source ? *source : *this; }
+    // Returns number of faces
+    int num_faces() const { return static_cast<int>(mesh().faces.size() / 3); }
+    // Inputs:
+    //   f  face index
+    //   c  corner index (0, 1 or 2)
+    // Returns position of corner c of face f
+    Eigen::Vector3d corner(const int f, const int c) const
+    {
+      const TriangleSoup & m = mesh();
+      const float * p = &m.vertices[3 * m.faces[3 * f + c]];
+      return Eigen::Vector3d(p[0], p[1], p[2]);
+    }
+    // Build `bvh` over the faces and pack its leaves into `blocks` (or
+    // `float_blocks`)
+    void build_bvh();
+    // Copy of the soup with its BVH and face blocks rebuilt in single
+    // precision (see Object::single_precision_copy). The copy reads the
+    // vertices and faces of this soup rather than duplicating them, so it
+    // only adds its BVH and FloatTriangleBlocks. Single precision leaves hold
+    // a FloatTriangleBlock each, so the copy's BVH has leaves of up to eight
+    // faces. Hits do not change.
+    std::shared_ptr<Object> single_precision_copy(
+      SinglePrecisionCopies & copies) const;
 
     // Intersect a triangle soup with ray.
     //
@@ -25,7 +80,41 @@ class TriangleSoup : public Object
     // Returns iff there a first intersection is found.
     bool intersect(
       const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const;
+    // Find the first face hit in [min_t,max_t) (see Object::intersect_hit).
+    //
+    // Outputs:
+    //   hit  hit.primitive is the index of the face hit (ties go to the
+    //     lower index)
+    bool intersect_hit(
+      const Ray & ray,
+      const double min_t,
+      const double max_t,
+      Hit & hit) const;
+    // Returns unit normal of face hit.primitive
+    Eigen::Vector3d surface_normal(const Ray & ray, const Hit & hit) const;
+    // Determine whether the triangle soup blocks a ray in [min_t,max_t).
+    //
+    // Inputs:
+    //   ray  ray to intersect with
+    //   min_t  minimum parametric distance to consider
+    //   max_t  maximum parametric distance to consider (exclusive)
+    // Returns true iff intersect would find a hit with t < max_t
+    bool occluded(
+      const Ray & ray, const double min_t, const double max_t) const;
+    // Axis-aligned bounding box of the triangle soup.
+    //
+    // Outputs:
+    //   box  tight box around all vertices of the soup
+    // Returns false iff the soup has no faces
+    bool bounding_box(AABB & box) const;
+
+  private:
+    // Whether the BVH and the face blocks are in single precision (only in
+    // copies made by single_precision_copy)
+    bool single = false;
+    // Soup whose vertices and faces a single precision copy reads (nullptr
+    // otherwise)
+    const TriangleSoup * source = nullptr;
 };
 
 #endif
-
@@ -3,6 +3,7 @@
 #include "Ray.h"
 #include "Light.h"
 #include "Object.h"
+#include "CompiledScene.h"
 #include <Eigen/Core>
 #include <vector>
 #include <memory>
@@ -15,17 +16,77 @@
 // Inputs:
 //   ray  incoming ray
 //   hit_id  index into objects of the object just hit by ray
+//   hit_part  part of objects[hit_id] hit by ray (see first_hit)
 //   t  _parametric_ distance along ray to hit
 //   n  unit surface normal at hit
 //   objects  list of objects in the scene
+//   scene  objects compiled for shadow rays (see CompiledScene)
 //   lights  list of lights in the scene
 // Returns shaded color collected by this ray as rgb 3-vector
 Eigen::Vector3d blinn_phong_shading(
   const Ray & ray,
   const int & hit_id, 
+  const int & hit_part,
   const double & t,
   const Eigen::Vector3d & n,
   const std::vector< std::shared_ptr<Object> > & objects,
+  const CompiledScene & scene,
   const std::vector<std::shared_ptr<Light> > & lights);
 
+// Ambient term of blinn_phong_shading
+//
+// Inputs:
+//   mat  material at the hit
+// Returns ambient color (ia * ka)
+Eigen::Vector3d blinn_phong_ambient(const Material & mat);
+
+// Diffuse and specular term of one light in blinn_phong_shading, and the
+// shadow ray that decides whether it applies.
+//
+// Inputs:
+//   ray  incoming ray
+//   t  _parametric_ distance along ray to hit
+//   n  unit surface normal at hit
+//   mat  material at the hit
+//   light  light to shade with
+// Outputs:
+//   shadow_ray  ray from the hit toward the light
+//   min_t  minimum parametric distance to test shadow_ray from
+//   max_t  parametric distance along shadow_ray to the light
+//   color  diffuse + specular color if shadow_ray is not occluded
+// Returns false iff the light is behind the surface (contributes nothing,
+// and needs no shadow ray)
+bool blinn_phong_light(
+  const Ray & ray,
+  const double t,
+  const Eigen::Vector3d & n,
+  const Material & mat,
+  const Light & light,
+  Ray & shadow_ray,
+  double & min_t,
+  double & max_t,
+  Eigen::Vector3d & color);
+// Same as above for a hit whose point and view vector are already known, so
+// callers shading one hit with many lights compute them once
+//
+// Inputs:
+//   p  hit point (ray.origin + t * ray.direction)
+//   v  unit vector from p toward the ray's origin (-ray.direction normalized)
+//   n  unit surface normal at hit
+//   mat  material at the hit
+//   light  light to shade with
+// Outputs:
+//   shadow_ray, min_t, max_t, color  see above
+// Returns false iff the light is behind the surface
+bool blinn_phong_light(
+  const Eigen::Vector3d & p,
+  const Eigen::Vector3d & v,
+  const Eigen::Vector3d & n,
+  const Material & mat,
+  const Light & light,
+  Ray & shadow_ray,
+  double & min_t,
+  double & max_t,
+  Eigen::Vector3d & color);
+
 #endif
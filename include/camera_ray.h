@@ -0,0 +1,44 @@
+#ifndef CAMERA_RAY_H
+#define CAMERA_RAY_H
+
+#include "Ray.h"
+#include "Camera.h"
+#include "Sampler.h"
+
+// Construct the viewing ray of one camera sample. The position within the
+// pixel (if jittering) and the point on the lens (if the aperture is open)
+// come from independent dimensions of the sample's sampler, so anti-aliasing
+// and depth of field do not correlate.
+//
+// Inputs:
+//   camera  Perspective camera (aperture 0 = pinhole)
+//   i  pixel row index
+//   j  pixel column index
+//   width  number of pixels width of image
+//   height  number of pixels height of image
+//   jitter  whether to spread samples over the pixel area (anti-aliasing)
+//     instead of shooting through its center
+//   sampler  random numbers of this camera sample
+// Outputs:
+//   ray  viewing ray (see viewing_ray_dof)
+void camera_ray(
+  const Camera & camera,
+  const int i,
+  const int j,
+  const int width,
+  const int height,
+  const bool jitter,
+  const Sampler & sampler,
+  Ray & ray);
+
+// Determine whether camera_ray depends on its sampler at all. If it does not
+// (a pinhole camera without jitter), every sample of a pixel is the same ray
+// and renderers can trace it once instead of once per sample.
+//
+// Inputs:
+//   camera  Perspective camera
+//   jitter  as passed to camera_ray
+// Returns true iff different samples can produce different rays
+bool camera_ray_is_random(const Camera & camera, const bool jitter);
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef COALESCE_SPHERES_H
+#define COALESCE_SPHERES_H
+
+#include "Object.h"
+#include <vector>
+#include <memory>
+
+// Replace every run of consecutive Sphere objects (at least min_run long)
+// with a single SphereSet holding the same spheres and materials, so
+// sphere-heavy scenes are intersected a SIMD block at a time. The set takes
+// the place of the first sphere of its run and keeps the run's order, so
+// first_hit still breaks ties exactly as before; hit ids of the objects after
+// a run shift down accordingly.
+//
+// Inputs:
+//   objects  list of objects (shapes) in the scene
+//   min_run  shortest run of spheres worth replacing
+// Outputs:
+//   objects  list with sphere runs replaced by SphereSets
+// Returns number of spheres moved into sets
+int coalesce_spheres(
+  std::vector<std::shared_ptr<Object> > & objects,
+  const int min_run = 4);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef DOF_PREVIEW_H
+#define DOF_PREVIEW_H
+
+#include "Camera.h"
+#include "ThreadPool.h"
+#include <vector>
+
+// Radius of the circle of confusion of a point seen through the thin lens of
+// viewing_ray_dof. A lens point at offset L from the eye moves the image of a
+// point at depth z by d*L*(1/focal_distance - 1/z) on the image plane, so the
+// point is spread over a disk of that radius for |L| = aperture.
+//
+// Inputs:
+//   camera  Perspective camera with aperture and focal distance
+//   width  number of pixels width of image
+//   depth  distance of the point along -w from the eye
+// Returns radius in pixels (0 for a pinhole camera)
+double circle_of_confusion(
+  const Camera & camera,
+  const int width,
+  const double depth);
+
+// Approximate the depth of field of camera from a pinhole render and its
+// depths, for previewing focus and aperture changes without tracing again.
+// Every pixel gathers neighbours along a golden-angle spiral out to the
+// largest circle of confusion around it; a neighbour counts if its own circle
+// reaches the pixel, and one behind the pixel reaches at most twice as far as
+// the pixel's circle, so blurry backgrounds do not bleed over sharp
+// foregrounds while blurry foregrounds do spread over what lies behind them.
+//
+// Inputs:
+//   camera  Perspective camera with aperture and focal distance
+//   width  number of pixels width of image
+//   height  number of pixels height of image
+//   radiance  3*width*height list of linear RGB values of the pinhole render
+//   depth  width*height list of depths along -w (infinity for misses)
+//   pool  threads to blur with
+// Outputs:
+//   blurred  3*width*height list of linear RGB values
+void dof_preview(
+  const Camera & camera,
+  const int width,
+  const int height,
+  const std::vector<float> & radiance,
+  const std::vector<float> & depth,
+  ThreadPool & pool,
+  std::vector<float> & blurred);
+
+#endif
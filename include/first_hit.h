@@ -3,6 +3,7 @@
 
 #include "Ray.h"
 #include "Object.h"
+#include "BVH.h"
 #include <Eigen/Core>
 #include <vector>
 #include <memory>
@@ -28,4 +29,32 @@ bool first_hit(
   double & t,
   Eigen::Vector3d & n);
 
+// Same as above, but only tests the objects whose boxes in a bounding volume
+// hierarchy built over `objects` are hit by the ray, and also reports which
+// part of the object was hit (see Object::intersect_part). Returns exactly the
+// same hit as the brute-force version (ties are broken toward the lower
+// index). If `bvh` is empty, tests every object.
+//
+// Inputs:
+//   ray  ray along which to search
+//   min_t  minimum t value to consider
+//   objects  list of objects (shapes) in the scene
+//   bvh  hierarchy built with bvh.build(objects)
+// Outputs:
+//   hit_id  index into objects of object with first hit
+//   hit_part  part of objects[hit_id] that was hit
+//   t  _parametric_ distance along ray so that ray.origin+t*ray.direction is
+//     the hit location
+//   n  surface normal at hit location
+// Returns true iff a hit was found
+bool first_hit(
+  const Ray & ray, 
+  const double min_t,
+  const std::vector< std::shared_ptr<Object> > & objects,
+  const BVH & bvh,
+  int & hit_id, 
+  int & hit_part,
+  double & t,
+  Eigen::Vector3d & n);
+
 #endif
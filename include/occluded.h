@@ -0,0 +1,30 @@
+#ifndef OCCLUDED_H
+#define OCCLUDED_H
+
+#include "Ray.h"
+#include "Object.h"
+#include "BVH.h"
+#include <vector>
+#include <memory>
+
+// Determine whether any scene object blocks a ray within a parametric
+// interval (an any-hit query). Unlike first_hit it stops at the first
+// blocker it finds and never computes normals, which is all a shadow ray
+// needs.
+//
+// Inputs:
+//   ray  ray along which to search
+//   min_t  minimum t value to consider
+//   max_t  maximum t value to consider (exclusive; may be infinite)
+//   objects  list of objects (shapes) in the scene
+//   bvh  hierarchy built with bvh.build(objects) (if empty, every object is
+//     tested)
+// Returns true iff first_hit would find a hit with t < max_t
+bool occluded(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  const std::vector< std::shared_ptr<Object> > & objects,
+  const BVH & bvh);
+
+#endif
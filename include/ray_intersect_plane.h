@@ -0,0 +1,49 @@
+#ifndef RAY_INTERSECT_PLANE_H
+#define RAY_INTERSECT_PLANE_H
+
+#include "Ray.h"
+#include <Eigen/Core>
+#include <cmath>
+
+// Intersect a ray with a plane. Shared by Plane and CompiledScene so that a
+// plane gives the same answer whichever representation holds it.
+//
+// Inputs:
+//   ray  ray to intersect with
+//   point  point on the plane
+//   normal  normal of the plane (need not be unit length)
+//   min_t  minimum parametric distance to consider (hits must be at least
+//     1e-9 beyond it)
+//   max_t  maximum parametric distance to consider (exclusive)
+// Outputs:
+//   t  parametric distance of the hit, if any
+// Returns true iff the ray hits the plane in (min_t,max_t)
+inline bool ray_intersect_plane(
+  const Ray & ray,
+  const Eigen::Vector3d & point,
+  const Eigen::Vector3d & normal,
+  const double min_t,
+  const double max_t,
+  double & t)
+{
+  // Equation: (p - point) · normal = 0
+  // Ray: r(t) = ray.origin + t * ray.direction
+  const double denom = normal.dot(ray.direction);
+  const double eps = 1e-9;
+
+  // If denom ~ 0, ray is parallel to the plane = no intersection
+  if (std::abs(denom) < eps) {
+    return false;
+  }
+
+  const double tt = normal.dot(point - ray.origin) / denom;
+
+  // Only accept intersections in front of ray origin, beyond min_t
+  if (!(tt >= min_t + eps && tt < max_t)) {
+    return false;
+  }
+  t = tt;
+  return true;
+}
+
+#endif
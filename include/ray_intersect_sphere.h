@@ -0,0 +1,71 @@
+#ifndef RAY_INTERSECT_SPHERE_H
+#define RAY_INTERSECT_SPHERE_H
+
+#include "Ray.h"
+#include <Eigen/Core>
+#include <cmath>
+
+// Intersect a ray with a sphere. Shared by Sphere and CompiledScene so that
+// a sphere gives the same answer whichever representation holds it. The
+// normal is left to the caller: it is only needed for the closest hit.
+//
+// Inputs:
+//   ray  ray to intersect with
+//   center  center of the sphere
+//   radius  radius of the sphere
+//   min_t  minimum parametric distance to consider (hits must be at least
+//     1e-9 beyond it)
+//   max_t  maximum parametric distance to consider (exclusive)
+// Outputs:
+//   t  parametric distance of the first root past min_t, if any
+// Returns true iff that root is less than max_t
+inline bool ray_intersect_sphere(
+  const Ray & ray,
+  const Eigen::Vector3d & center,
+  const double radius,
+  const double min_t,
+  const double max_t,
+  double & t)
+{
+  // Sphere equation: |(o + t d) - c|^2 = r^2
+  // Solve quadratic in t: (d·d)t^2 + 2oc·d t + (oc·oc - r^2) = 0
+  const Eigen::Vector3d oc = ray.origin - center;
+  const Eigen::Vector3d & d = ray.direction;
+
+  const double a = d.dot(d);                 // usually 1 if d is normalized
+  const double b = 2.0 * oc.dot(d);
+  const double c = oc.dot(oc) - radius * radius;
+
+  const double discriminant = b * b - 4.0 * a * c;
+  if (discriminant < 0.0) {
+    return false; // no real roots = no intersection
+  }
+
+  const double sqrt_disc = std::sqrt(discriminant);
+  const double t0 = (-b - sqrt_disc) / (2.0 * a);
+  const double t1 = (-b + sqrt_disc) / (2.0 * a);
+
+  // Pick the closest valid t >= min_t
+  const double eps = 1e-9;
+  double tt;
+  if (t0 >= min_t + eps) {
+    tt = t0;
+  } else if (t1 >= min_t + eps) {
+    tt = t1;
+  } else {
+    return false; // both behind the ray or too close
+  }
+  if (!(tt < max_t)) return false;
+  t = tt;
+  return true;
+}
+
+// Unit outward normal of a sphere at a point on its surface
+inline Eigen::Vector3d sphere_normal(
+  const Eigen::Vector3d & center,
+  const Eigen::Vector3d & p)
+{
+  return (p - center).normalized();
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef RAY_INTERSECT_TRIANGLE_H
+#define RAY_INTERSECT_TRIANGLE_H
+
+#include "Ray.h"
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <cmath>
+
+// Intersect a ray with a triangle given by one corner and its two edges
+// (Moller-Trumbore). Shared by Triangle and TriangleSoup so that a face gives
+// the same answer whichever object holds it. The normal is left to the
+// caller: a mesh only needs it for the closest face.
+//
+// Inputs:
+//   ray  ray to intersect with
+//   v0  first corner of the triangle
+//   e1  second corner minus first corner
+//   e2  third corner minus first corner
+//   min_t  minimum parametric distance to consider (hits must be at least
+//     1e-9 beyond it)
+//   max_t  maximum parametric distance to consider (exclusive)
+// Outputs:
+//   t  parametric distance of the hit, if any
+// Returns true iff the ray hits the triangle in (min_t,max_t)
+inline bool ray_intersect_triangle_edges(
+  const Ray & ray,
+  const Eigen::Vector3d & v0,
+  const Eigen::Vector3d & e1,
+  const Eigen::Vector3d & e2,
+  const double min_t,
+  const double max_t,
+  double & t)
+{
+  const Eigen::Vector3d pvec = ray.direction.cross(e2);
+  const double det = e1.dot(pvec);
+
+  const double eps = 1e-9;
+  if (std::abs(det) < eps) return false; // ray parallel to triangle
+
+  const double invDet = 1.0 / det;
+
+  const Eigen::Vector3d tvec = ray.origin - v0;
+  const double u = tvec.dot(pvec) * invDet;
+  if (u < 0.0 || u > 1.0) return false;
+
+  const Eigen::Vector3d qvec = tvec.cross(e1);
+  const double v = ray.direction.dot(qvec) * invDet;
+  if (v < 0.0 || u + v > 1.0) return false;
+
+  const double tt = e2.dot(qvec) * invDet;
+  if (!(tt >= min_t + eps && tt < max_t)) return false;
+
+  t = tt;
+  return true;
+}
+
+// Intersect a ray with a triangle given by its corners (see
+// ray_intersect_triangle_edges)
+inline bool ray_intersect_triangle(
+  const Ray & ray,
+  const Eigen::Vector3d & v0,
+  const Eigen::Vector3d & v1,
+  const Eigen::Vector3d & v2,
+  const double min_t,
+  const double max_t,
+  double & t)
+{
+  return ray_intersect_triangle_edges(ray, v0, v1 - v0, v2 - v0, min_t, max_t, t);
+}
+
+// Unit normal of a triangle (right-handed winding v0,v1,v2)
+inline Eigen::Vector3d triangle_normal(
+  const Eigen::Vector3d & v0,
+  const Eigen::Vector3d & v1,
+  const Eigen::Vector3d & v2)
+{
+  return (v1 - v0).cross(v2 - v0).normalized();
+}
+
+#endif
@@ -3,18 +3,39 @@
 #include "Ray.h"
 #include "Object.h"
 #include "Light.h"
+#include "CompiledScene.h"
+#include "Sampler.h"
 #include <Eigen/Core>
 #include <vector>
 
-// Shoot a ray into a lit scene and collect color information.
+// Controls for how far raycolor follows mirror reflections
+struct RaycolorOptions
+{
+  // Maximum number of mirror bounces
+  int max_depth = 9;
+  // Mirror bounces are only followed while the throughput of the path (the
+  // product of the km's seen so far) has a component of at least this much.
+  // With km = 0.01 the second bounce is weighted by 1e-4, well below one
+  // 8-bit step.
+  double min_throughput = 1e-3;
+  // Instead of stopping when the throughput drops below min_throughput,
+  // continue with probability max(throughput)/min_throughput and divide the
+  // throughput by that probability (unbiased, but noisy)
+  bool russian_roulette = false;
+};
+
+// Shoot a ray into a lit scene and collect color information, following
+// mirror reflections iteratively.
 //
 // Inputs:
 //   ray  ray along which to search
 //   min_t  minimum t value to consider (for viewing rays, this is typically at
 //     least the _parametric_ distance of the image plane to the camera)
 //   objects  list of objects (shapes) in the scene
+//   scene  objects compiled for ray queries (see CompiledScene)
 //   lights  list of lights in the scene
-//   num_recursive_calls  how many times has raycolor been called already
+//   options  path termination controls
+//   sampler  random numbers of this camera sample (used for russian roulette)
 // Outputs:
 //   rgb  collected color 
 // Returns true iff a hit was found
@@ -22,8 +43,72 @@ bool raycolor(
   const Ray & ray, 
   const double min_t,
   const std::vector< std::shared_ptr<Object> > & objects,
+  const CompiledScene & scene,
+  const std::vector< std::shared_ptr<Light> > & lights,
+  const RaycolorOptions & options,
+  const Sampler & sampler,
+  Eigen::Vector3d & rgb);
+
+// Same as raycolor, for a ray whose first hit has already been found (e.g.,
+// by CompiledScene::first_hit_packet)
+//
+// Inputs:
+//   ray  ray along which the hit was found
+//   hit  whether the ray hits anything
+//   hit_id  index into objects of object hit (if hit)
+//   hit_part  part of objects[hit_id] that was hit (if hit)
+//   t  _parametric_ distance of the hit along ray (if hit)
+//   n  surface normal at hit location (if hit)
+//   objects  list of objects (shapes) in the scene
+//   scene  objects compiled for ray queries (see CompiledScene)
+//   lights  list of lights in the scene
+//   options  path termination controls
+//   sampler  random numbers of this camera sample (used for russian roulette)
+// Outputs:
+//   rgb  collected color
+// Returns hit
+bool raycolor_from_hit(
+  const Ray & ray,
+  const bool hit,
+  const int hit_id,
+  const int hit_part,
+  const double t,
+  const Eigen::Vector3d & n,
+  const std::vector< std::shared_ptr<Object> > & objects,
+  const CompiledScene & scene,
   const std::vector< std::shared_ptr<Light> > & lights,
-  const int num_recursive_calls,
+  const RaycolorOptions & options,
+  const Sampler & sampler,
   Eigen::Vector3d & rgb);
 
+// Decide whether a path continues with a mirror reflection after shading a
+// hit (the termination rules of raycolor: depth limit, km = 0, throughput
+// cutoff or russian roulette), and if so construct the reflected ray.
+//
+// Inputs:
+//   ray  ray that hit
+//   t  _parametric_ distance of the hit along ray
+//   n  surface normal at hit location
+//   mat  material at the hit
+//   depth  number of reflections followed so far
+//   options  path termination controls
+//   sampler  random numbers of this camera sample
+//   throughput  product of the mirror coefficients of the path so far
+// Outputs:
+//   throughput  updated to include this reflection (if it continues)
+//   next  reflected ray (may be the same object as ray)
+//   next_min_t  minimum t value to consider along next
+// Returns true iff the path continues
+bool raycolor_bounce(
+  const Ray & ray,
+  const double t,
+  const Eigen::Vector3d & n,
+  const Material & mat,
+  const int depth,
+  const RaycolorOptions & options,
+  const Sampler & sampler,
+  Eigen::Vector3d & throughput,
+  Ray & next,
+  double & next_min_t);
+
 #endif
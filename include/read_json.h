@@ -26,19 +26,24 @@ inline bool read_json(
 // Implementation
 
 #include <json.hpp>
-#include "readSTL.h"
+#include "read_stl.h"
 #include "dirname.h"
 #include "Object.h"
 #include "Sphere.h"
 #include "Plane.h"
 #include "Triangle.h"
 #include "TriangleSoup.h"
+#include "Group.h"
+#include "Instance.h"
+#include "coalesce_spheres.h"
 #include "Light.h"
 #include "PointLight.h"
 #include "DirectionalLight.h"
 #include "Material.h"
 #include <Eigen/Geometry>
+#include <cmath>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <cassert>
 
@@ -131,75 +136,181 @@ inline bool read_json(
   };
   parse_lights(j["lights"],lights);
 
-  auto parse_objects = [&parse_Vector3d,&filename,&materials](
-    const json & j,
-    std::vector<std::shared_ptr<Object> > & objects)
+  // Objects that can be placed again by name ("instance" objects), and
+  // meshes by file so that each STL is read once
+  std::unordered_map<std::string,std::shared_ptr<Object> > named;
+  std::unordered_map<std::string,std::shared_ptr<TriangleSoup> > soups;
+
+  // parse an optional placement: "transform" (4x4 row-major matrix, 16
+  // numbers) and/or "translate" [x,y,z], "rotate" {"axis": [x,y,z],
+  // "degrees": a} and "scale" (number or [x,y,z]), applied scale first and
+  // the matrix last. Returns false if there is none.
+  auto parse_transform =
+    [&parse_Vector3d](const json & j, Eigen::Affine3d & transform) -> bool
   {
-    objects.clear();
-    for(const json & jobj : j)
+    transform = Eigen::Affine3d::Identity();
+    bool placed = false;
+    if(j.count("scale"))
     {
-      if(jobj["type"] == "sphere")
-      {
-        std::shared_ptr<Sphere> sphere(new Sphere());
-        sphere->center = parse_Vector3d(jobj["center"]);
-        sphere->radius = jobj["radius"].get<double>();
-        objects.push_back(sphere);
-      }else if(jobj["type"] == "plane")
-      {
-        std::shared_ptr<Plane> plane(new Plane());
-        plane->point = parse_Vector3d(jobj["point"]);
-        plane->normal = parse_Vector3d(jobj["normal"]).normalized();
-        objects.push_back(plane);
-      }else if(jobj["type"] == "triangle")
-      {
-        std::shared_ptr<Triangle> tri(new Triangle());
-        tri->corners = std::make_tuple(
-          parse_Vector3d(jobj["corners"][0]),
-          parse_Vector3d(jobj["corners"][1]),
-          parse_Vector3d(jobj["corners"][2]));
-        objects.push_back(tri);
-      }else if(jobj["type"] == "soup")
+      const json & js = j["scale"];
+      transform.scale(
+        js.is_array() ? parse_Vector3d(js) :
+        Eigen::Vector3d::Constant(js.get<double>()));
+      placed = true;
+    }
+    if(j.count("rotate"))
+    {
+      const double degrees = j["rotate"]["degrees"].get<double>();
+      transform.prerotate(Eigen::AngleAxisd(
+        degrees * std::acos(-1.0) / 180.0,
+        parse_Vector3d(j["rotate"]["axis"]).normalized()));
+      placed = true;
+    }
+    if(j.count("translate"))
+    {
+      transform.pretranslate(parse_Vector3d(j["translate"]));
+      placed = true;
+    }
+    if(j.count("transform"))
+    {
+      Eigen::Matrix4d m;
+      for(int r = 0; r < 4; ++r)
       {
-        std::vector<std::vector<double> > V;
-        std::vector<std::vector<double> > F;
-        std::vector<std::vector<int> > N;
+        for(int c = 0; c < 4; ++c)
         {
+          m(r,c) = j["transform"][4*r+c].get<double>();
+        }
+      }
+      transform = Eigen::Affine3d(m) * transform;
+      placed = true;
+    }
+    return placed;
+  };
+
+  std::function<std::shared_ptr<Object>(const json &)> parse_object =
+    [&](const json & jobj) -> std::shared_ptr<Object>
+  {
+    std::shared_ptr<Object> object;
+    if(jobj["type"] == "sphere")
+    {
+      std::shared_ptr<Sphere> sphere(new Sphere());
+      sphere->center = parse_Vector3d(jobj["center"]);
+      sphere->radius = jobj["radius"].get<double>();
+      object = sphere;
+    }else if(jobj["type"] == "plane")
+    {
+      std::shared_ptr<Plane> plane(new Plane());
+      plane->point = parse_Vector3d(jobj["point"]);
+      plane->normal = parse_Vector3d(jobj["normal"]).normalized();
+      object = plane;
+    }else if(jobj["type"] == "triangle")
+    {
+      std::shared_ptr<Triangle> tri(new Triangle());
+      tri->corners = std::make_tuple(
+        parse_Vector3d(jobj["corners"][0]),
+        parse_Vector3d(jobj["corners"][1]),
+        parse_Vector3d(jobj["corners"][2]));
+      object = tri;
+    }else if(jobj["type"] == "soup")
+    {
 #if defined(WIN32) || defined(_WIN32)
 #define PATH_SEPARATOR std::string("\\")
 #else
 #define PATH_SEPARATOR std::string("/")
 #endif
-          const std::string stl_path = jobj["stl"];
-          igl::readSTL(
-              igl::dirname(filename)+
-              PATH_SEPARATOR +
-              stl_path,
-              V,F,N);
-        }
-        std::shared_ptr<TriangleSoup> soup(new TriangleSoup());
-        for(int f = 0;f<F.size();f++)
-        {
-          std::shared_ptr<Triangle> tri(new Triangle());
-          tri->corners = std::make_tuple(
-            Eigen::Vector3d( V[F[f][0]][0], V[F[f][0]][1], V[F[f][0]][2]),
-            Eigen::Vector3d( V[F[f][1]][0], V[F[f][1]][1], V[F[f][1]][2]),
-            Eigen::Vector3d( V[F[f][2]][0], V[F[f][2]][1], V[F[f][2]][2])
-          );
-          soup->triangles.push_back(tri);
-        }
-        objects.push_back(soup);
+      const std::string stl_path = jobj["stl"];
+      std::shared_ptr<TriangleSoup> & soup = soups[stl_path];
+      if(soup)
+      {
+        // Already read: share the faces (with this object's own material)
+        object = std::make_shared<Instance>(soup, Eigen::Affine3d::Identity());
+      }else
+      {
+        soup.reset(new TriangleSoup());
+        read_stl(
+            igl::dirname(filename)+
+            PATH_SEPARATOR +
+            stl_path,
+            soup->vertices,
+            soup->faces);
+        soup->build_bvh();
+        object = soup;
+      }
+    }else if(jobj["type"] == "group")
+    {
+      std::shared_ptr<Group> group(new Group());
+      // Children without a material of their own use the group's
+      std::shared_ptr<Material> group_material;
+      if(jobj.count("material") && materials.count(jobj["material"]))
+      {
+        group_material = materials[jobj["material"]];
       }
-      //objects.back()->material = default_material;
-      if(jobj.count("material"))
+      for(const json & jchild : jobj["objects"])
       {
-        if(materials.count(jobj["material"]))
+        if(std::shared_ptr<Object> child = parse_object(jchild))
         {
-          objects.back()->material = materials[jobj["material"]];
+          if(!child->material) child->material = group_material;
+          group->objects.push_back(child);
         }
       }
+      coalesce_spheres(group->objects);
+      group->build();
+      object = group;
+    }else if(jobj["type"] == "instance")
+    {
+      const std::string name = jobj["object"];
+      if(!named.count(name))
+      {
+        std::cerr << "Unknown object " << name << " in instance" << std::endl;
+        return nullptr;
+      }
+      Eigen::Affine3d transform;
+      parse_transform(jobj, transform);
+      object = std::make_shared<Instance>(named[name], transform);
+    }else
+    {
+      return nullptr;
+    }
+    //object->material = default_material;
+    if(jobj.count("material"))
+    {
+      if(materials.count(jobj["material"]))
+      {
+        object->material = materials[jobj["material"]];
+      }
+    }
+    if(jobj.count("name"))
+    {
+      named[jobj["name"]] = object;
     }
+    // Place the object if asked to (instances are placed already)
+    Eigen::Affine3d transform;
+    if(jobj["type"] != "instance" && parse_transform(jobj, transform))
+    {
+      std::shared_ptr<Object> placed(new Instance(object, transform));
+      object = placed;
+    }
+    return object;
   };
-  parse_objects(j["objects"],objects);
+
+  // Named objects that are only placed through instances
+  if(j.count("definitions"))
+  {
+    for(const json & jobj : j["definitions"])
+    {
+      parse_object(jobj);
+    }
+  }
+  objects.clear();
+  for(const json & jobj : j["objects"])
+  {
+    if(std::shared_ptr<Object> object = parse_object(jobj))
+    {
+      objects.push_back(object);
+    }
+  }
+  // Intersect runs of spheres as SIMD batches (materials stay per sphere)
+  coalesce_spheres(objects);
 
   return true;
 }
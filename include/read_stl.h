@@ -0,0 +1,27 @@
+#ifndef READ_STL_H
+#define READ_STL_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Read the triangles of an .stl file as an indexed mesh. Binary files
+// (recognized by their size matching the face count in the header) are memory
+// mapped and decoded straight from their 50-byte face records in one pass;
+// anything else that starts with "solid" is parsed as ASCII with
+// igl::readSTL. Positions are kept in single precision, like binary STL
+// stores them, and corners with bitwise equal positions are merged into one
+// vertex.
+//
+// Inputs:
+//   filename  path to .stl file
+// Outputs:
+//   V  #V*3 list of vertex positions (x,y,z of vertex v at V[3v+0..2])
+//   F  #F*3 list of vertex indices (corners of face f at F[3f+0..2])
+// Returns true on success, false on failure (can't open file, bad format)
+bool read_stl(
+  const std::string & filename,
+  std::vector<float> & V,
+  std::vector<std::uint32_t> & F);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef RENDER_IMAGE_H
+#define RENDER_IMAGE_H
+
+#include "Object.h"
+#include "Camera.h"
+#include "Light.h"
+#include "CompiledScene.h"
+#include "RayStats.h"
+#include "ThreadPool.h"
+#include "raycolor.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Settings of a batch render
+struct RenderSettings
+{
+  int width = 1280;
+  int height = 720;
+  int samples_per_pixel = 32;
+  // Frame seed (see Sampler)
+  unsigned seed = 42;
+  // Spread samples over the pixel area (anti-aliasing)
+  bool jitter = true;
+  // Side of the square pixel blocks whose camera rays are traced as one
+  // packet (2, 4 or 8; 1 traces every camera ray on its own). The image is
+  // the same either way.
+  int packet_size = 4;
+  RaycolorOptions path;
+};
+
+// Number of samples render_image actually traces per pixel: if no sample
+// dimension has an effect (pinhole camera, no jitter, no russian roulette)
+// every sample of a pixel is the same path and it is traced once.
+//
+// Inputs:
+//   camera  Perspective camera
+//   settings  render settings
+// Returns number of traced samples per pixel
+int render_samples_per_pixel(
+  const Camera & camera,
+  const RenderSettings & settings);
+
+// Render a scene with the batch renderer's film look (warm grading,
+// vignetting, grain). The frame is split into 32x32 tiles that the pool hands
+// out with work stealing; the image does not depend on the thread count.
+// Within a tile, the camera rays of each sample of a block of pixels find
+// their first hits as one packet (see CompiledScene::first_hit_packet).
+//
+// Inputs:
+//   camera  Perspective camera
+//   objects  list of objects (shapes) in the scene
+//   scene  objects compiled for ray queries (see CompiledScene)
+//   lights  list of lights in the scene
+//   settings  render settings
+//   pool  threads to render with
+//   progress  if set, called as progress(tiles_done, num_tiles, stats) after
+//     each tile, one call at a time
+// Outputs:
+//   rgb_image  3*width*height list of 8-bit RGB values, row-major from the top
+//   stats  number of rays traced, by kind
+void render_image(
+  const Camera & camera,
+  const std::vector< std::shared_ptr<Object> > & objects,
+  const CompiledScene & scene,
+  const std::vector< std::shared_ptr<Light> > & lights,
+  const RenderSettings & settings,
+  ThreadPool & pool,
+  std::vector<unsigned char> & rgb_image,
+  RayStats & stats,
+  const std::function<void(const int, const int, const RayStats &)> &
+    progress = nullptr);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef ROUND_FLOAT_H
+#define ROUND_FLOAT_H
+
+#include <cmath>
+#include <limits>
+
+// Round a double to single precision toward -infinity, so that the result is
+// never above the input (used to round boxes and intervals outward when
+// single precision copies must contain the double ones).
+//
+// Inputs:
+//   x  value to round
+// Returns largest float <= x (-infinity below the float range)
+inline float round_down_float(const double x)
+{
+  const float max = std::numeric_limits<float>::max();
+  if(x > max) return max;
+  if(x < -max) return -std::numeric_limits<float>::infinity();
+  float f = static_cast<float>(x);
+  if(f > x) f = std::nextafter(f, -std::numeric_limits<float>::infinity());
+  return f;
+}
+
+// Round a double to single precision toward +infinity (see round_down_float)
+//
+// Inputs:
+//   x  value to round
+// Returns smallest float >= x (+infinity above the float range)
+inline float round_up_float(const double x)
+{
+  return -round_down_float(-x);
+}
+
+#endif
@@ -12,15 +12,21 @@
 //   j  pixel column index
 //   width  number of pixels width of image
 //   height  number of pixels height of image
+//   px, py  position within the pixel in [0,1] (0.5,0.5 is the pixel center;
+//     px runs along columns, py along rows)
 //   u, v  random numbers in [0,1] for lens sampling
 // Outputs:
-//   ray  viewing ray from random point on lens through focal point
+//   ray  viewing ray from random point on lens through focal point. If the
+//     aperture is 0 this is the pinhole ray through (px,py) of pixel (i,j),
+//     scaled like viewing_ray so that t=1 lands on the image plane.
 void viewing_ray_dof(
   const Camera & camera,
   const int i,
   const int j,
   const int width,
   const int height,
+  const double px,
+  const double py,
   const double u,
   const double v,
   Ray & ray);
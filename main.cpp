@@ -2,96 +2,120 @@
 #include "Camera.h"
 #include "Light.h"
 #include "read_json.h"
+#include "CompiledScene.h"
+#include "ThreadPool.h"
+#include "RayStats.h"
 #include "write_ppm.h"
 #include "write_png.h"
-#include "viewing_ray.h"
-#include "viewing_ray_dof.h"
 #include "raycolor.h"
-#include "post_process.h"
+#include "render_image.h"
 #include <Eigen/Core>
 #include <vector>
 #include <iostream>
 #include <memory>
 #include <limits>
 #include <functional>
-#include <random>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
 
 
 int main(int argc, char * argv[])
 {
+  // Usage: raytracing [scene.json] [--no-bvh] [--threads N] [--seed S]
+  //   [--min-throughput X] [--russian-roulette] [--no-jitter] [--packet 1|2|4|8]
+  //   [--float]
+  std::string scene_file = "../data/sphere-and-plane.json";
+  bool use_bvh = true;  // --no-bvh tests every object per ray (for A/B runs)
+  int num_threads = 0;  // 0 = one per hardware thread
+  unsigned seed = 42;   // Frame seed for reproducibility
+  RaycolorOptions path_options;
+  bool jitter = true;   // Spread samples over the pixel area (anti-aliasing)
+  int packet_size = 4;  // NxN camera ray packets (1 = single rays)
+  bool single_precision = false;  // Float hierarchies and mesh culling
+  for (int a = 1; a < argc; ++a) {
+    const std::string arg = argv[a];
+    if (arg == "--no-bvh") {
+      use_bvh = false;
+    } else if (arg == "--threads" && a + 1 < argc) {
+      num_threads = std::atoi(argv[++a]);
+    } else if (arg == "--seed" && a + 1 < argc) {
+      seed = static_cast<unsigned>(std::strtoul(argv[++a], nullptr, 10));
+    } else if (arg == "--min-throughput" && a + 1 < argc) {
+      path_options.min_throughput = std::atof(argv[++a]);
+    } else if (arg == "--russian-roulette") {
+      path_options.russian_roulette = true;
+    } else if (arg == "--no-jitter") {
+      jitter = false;
+    } else if (arg == "--packet" && a + 1 < argc) {
+      packet_size = std::atoi(argv[++a]);
+      if (packet_size != 1 && packet_size != 2 && packet_size != 4 &&
+          packet_size != 8) {
+        std::cerr << "--packet must be 1, 2, 4 or 8" << std::endl;
+        return 1;
+      }
+    } else if (arg == "--float") {
+      single_precision = true;
+    } else {
+      scene_file = arg;
+    }
+  }
+
   Camera camera;
   std::vector< std::shared_ptr<Object> > objects;
   std::vector< std::shared_ptr<Light> > lights;
   // Read a camera and scene description from given .json file
   read_json(
-    argc<=1?"../data/sphere-and-plane.json":argv[1],
+    scene_file,
     camera,
     objects,
     lights);
 
+  // Scene compiled for ray queries (without a hierarchy to brute force)
+  CompiledScene scene;
+  scene.build(objects, use_bvh, single_precision);
+
   // High quality render settings
   int width =  1280;  // High resolution for showcase
   int height = 720;
   int samples_per_pixel = 32;  // High quality samples for smooth bokeh
 
-  std::cout << "Rendering " << width << "x" << height
-            << " with " << samples_per_pixel << " samples/pixel..." << std::endl;
+  RenderSettings settings;
+  settings.width = width;
+  settings.height = height;
+  settings.samples_per_pixel = samples_per_pixel;
+  settings.seed = seed;
+  settings.jitter = jitter;
+  settings.packet_size = packet_size;
+  settings.path = path_options;
 
-  // Random number generator for sampling
-  std::mt19937 rng(42);  // Fixed seed for reproducibility
-  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  ThreadPool pool(num_threads);
+  std::cout << "Rendering " << width << "x" << height
+            << " with " << render_samples_per_pixel(camera, settings)
+            << " samples/pixel on " << pool.size() << " threads..." << std::endl;
 
   std::vector<unsigned char> rgb_image(3*width*height);
-
-  // For each pixel (i,j)
-  for(unsigned i=0; i<height; ++i)
+  RayStats stats;
+  const auto start = std::chrono::steady_clock::now();
+  auto report = [&](const int done, const int num_tiles, const RayStats & so_far)
   {
-    if (i % 50 == 0) {
-      std::cout << "Rendering row " << i << "/" << height << std::endl;
+    if (done % std::max(1, num_tiles / 20) == 0 || done == num_tiles) {
+      const double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+      std::cout << "Rendering tile " << done << "/" << num_tiles << " ("
+                << so_far.total() / std::max(seconds, 1e-9) / 1e6
+                << " Mrays/s)" << std::endl;
     }
-
-    for(unsigned j=0; j<width; ++j)
-    {
-      // Accumulate color from multiple samples
-      Eigen::Vector3d rgb(0,0,0);
-
-      // Multiple samples per pixel for depth of field
-      for (int s = 0; s < samples_per_pixel; ++s) {
-        Eigen::Vector3d sample_color(0,0,0);
-
-        // Random jitter for antialiasing and lens sampling
-        double u = uniform(rng);
-        double v = uniform(rng);
-
-        Ray ray;
-        if (camera.aperture > 0.0) {
-          // Use depth of field
-          viewing_ray_dof(camera, i, j, width, height, u, v, ray);
-        } else {
-          // Standard pinhole camera
-          viewing_ray(camera, i, j, width, height, ray);
-        }
-
-        // Shoot ray and collect color
-        raycolor(ray, 1.0, objects, lights, 0, sample_color);
-        rgb += sample_color;
-      }
-
-      // Average the samples
-      rgb /= double(samples_per_pixel);
-
-      // Apply film photography post-processing effects
-      rgb = apply_warm_grading(rgb, 0.3);        // Warm vintage look
-      rgb = apply_vignetting(rgb, i, j, width, height, 0.6);  // Stronger lens vignetting
-      rgb = apply_film_grain(rgb, i, j, 0.025);   // More visible film grain
-
-      // Write double precision color into image
-      auto clamp = [](double s){ return std::max(std::min(s,1.0),0.0);};
-      rgb_image[0+3*(j+width*i)] = 255.0*clamp(rgb(0));
-      rgb_image[1+3*(j+width*i)] = 255.0*clamp(rgb(1));
-      rgb_image[2+3*(j+width*i)] = 255.0*clamp(rgb(2));
-    }
-  }
+  };
+  render_image(
+    camera, objects, scene, lights, settings, pool, rgb_image, stats, report);
+
+  const double seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+  std::cout << "Rendered " << stats.total() << " rays in " << seconds << " s ("
+            << stats.total() / std::max(seconds, 1e-9) / 1e6 << " Mrays/s)"
+            << std::endl;
 
   std::cout << "Writing output..." << std::endl;
   write_ppm("piece.ppm",rgb_image,width,height,3);
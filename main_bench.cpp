@@ -0,0 +1,487 @@
+// Microbenchmarks for the intersection and shading kernels
+//
+// Runs every kernel over large pre-generated ray sets (coherent camera rays
+// and random incoherent rays) on one thread and reports ns/ray, rays/s and hit
+// rate, optionally as JSON so runs can be compared commit over commit.
+
+#include "Object.h"
+#include "Camera.h"
+#include "Light.h"
+#include "Sphere.h"
+#include "SphereSet.h"
+#include "Plane.h"
+#include "Triangle.h"
+#include "TriangleSoup.h"
+#include "BVH.h"
+#include "CompiledScene.h"
+#include "Sampler.h"
+#include "read_json.h"
+#include "first_hit.h"
+#include "blinn_phong_shading.h"
+#include "viewing_ray_dof.h"
+#include <json.hpp>
+#include <Eigen/Core>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Timing of one kernel over one ray set
+struct KernelResult
+{
+  std::string kernel;
+  std::string rays;
+  int count = 0;
+  // Best time over all repetitions
+  double seconds = 0;
+  // Number of rays that hit (-1 if the kernel has no notion of hits)
+  long long hits = -1;
+};
+
+// Defeats dead code elimination of kernel results
+static volatile double g_sink = 0;
+
+// Time kernel(k) for k in [0,count), keeping the fastest of `repeat` runs.
+// kernel returns 1 for a hit, 0 for a miss and -1 if hits do not apply.
+template <typename Kernel>
+static KernelResult run_kernel(
+  const std::string & kernel_name,
+  const std::string & rays_name,
+  const int count,
+  const int repeat,
+  Kernel && kernel)
+{
+  KernelResult result;
+  result.kernel = kernel_name;
+  result.rays = rays_name;
+  result.count = count;
+  result.seconds = std::numeric_limits<double>::infinity();
+  for(int r = 0; r < repeat; ++r)
+  {
+    long long hits = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for(int k = 0; k < count; ++k)
+    {
+      hits += kernel(k);
+    }
+    const double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+    result.seconds = std::min(result.seconds, seconds);
+    result.hits = hits < 0 ? -1 : hits;
+  }
+  return result;
+}
+
+// Pinhole rays from `eye` through a grid of pixel centers on the square
+// [-half,half]^2 at z=0 (row-major, so neighbours are adjacent)
+static std::vector<Ray> grid_rays(
+  const Eigen::Vector3d & eye,
+  const double half,
+  const int width,
+  const int height)
+{
+  std::vector<Ray> rays(width * height);
+  for(int i = 0; i < height; ++i)
+  {
+    for(int j = 0; j < width; ++j)
+    {
+      const Eigen::Vector3d target(
+        ((j + 0.5) / width * 2.0 - 1.0) * half,
+        -((i + 0.5) / height * 2.0 - 1.0) * half,
+        0.0);
+      rays[j + width * i].origin = eye;
+      rays[j + width * i].direction = target - eye;
+    }
+  }
+  return rays;
+}
+
+// Camera rays of a scene through pixel centers and the lens center
+static std::vector<Ray> camera_rays(
+  const Camera & camera,
+  const int width,
+  const int height)
+{
+  std::vector<Ray> rays(width * height);
+  for(int i = 0; i < height; ++i)
+  {
+    for(int j = 0; j < width; ++j)
+    {
+      viewing_ray_dof(
+        camera, i, j, width, height, 0.5, 0.5, 0.5, 0.5, rays[j + width * i]);
+    }
+  }
+  return rays;
+}
+
+// Uniformly random direction (not normalized: length in [0.5,1.5]) from a
+// deterministic sampler
+static Eigen::Vector3d random_direction(const Sampler & sampler, const int dim)
+{
+  const double z = 2.0 * sampler.uniform(dim) - 1.0;
+  const double phi = 2.0 * 3.14159265358979323846 * sampler.uniform(dim + 1);
+  const double r = std::sqrt(std::max(0.0, 1.0 - z * z));
+  const double len = 0.5 + sampler.uniform(dim + 2);
+  return len * Eigen::Vector3d(r * std::cos(phi), r * std::sin(phi), z);
+}
+
+// Incoherent rays: random origins inside a box with random directions
+static std::vector<Ray> random_rays(
+  const AABB & box,
+  const int count,
+  const unsigned seed)
+{
+  std::vector<Ray> rays(count);
+  const Eigen::Vector3d extent = box.max_corner - box.min_corner;
+  for(int k = 0; k < count; ++k)
+  {
+    const Sampler sampler(seed, k, 0, 0);
+    const Eigen::Vector3d r(
+      sampler.uniform(0), sampler.uniform(1), sampler.uniform(2));
+    rays[k].origin = box.min_corner + r.cwiseProduct(extent);
+    rays[k].direction = random_direction(sampler, 3);
+  }
+  return rays;
+}
+
+// Incoherent rays for a single primitive near the origin: from random points
+// on a sphere of radius 3 toward random points in [-1.5,1.5]^3
+static std::vector<Ray> random_primitive_rays(
+  const int count,
+  const unsigned seed)
+{
+  std::vector<Ray> rays(count);
+  for(int k = 0; k < count; ++k)
+  {
+    const Sampler sampler(seed, k, 1, 0);
+    const Eigen::Vector3d target(
+      3.0 * sampler.uniform(0) - 1.5,
+      3.0 * sampler.uniform(1) - 1.5,
+      3.0 * sampler.uniform(2) - 1.5);
+    rays[k].origin = 3.0 * random_direction(sampler, 3).normalized();
+    rays[k].direction = target - rays[k].origin;
+  }
+  return rays;
+}
+
+int main(int argc, char * argv[])
+{
+  // Usage: raytracing_bench [--scene scene.json] [--mesh-scene mesh.json]
+  //   [--width W] [--height H] [--repeat R] [--json out.json] [--label L]
+  std::string scene_file = "../data/showcase.json";
+  std::string mesh_scene_file = "../data/bunny.json";
+  std::string json_file;
+  std::string label;
+  int width = 512;
+  int height = 288;
+  int repeat = 5;
+  for (int a = 1; a < argc; ++a) {
+    const std::string arg = argv[a];
+    if (a + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return 1;
+    }
+    if (arg == "--scene") {
+      scene_file = argv[++a];
+    } else if (arg == "--mesh-scene") {
+      mesh_scene_file = argv[++a];
+    } else if (arg == "--width") {
+      width = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--height") {
+      height = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--repeat") {
+      repeat = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--json") {
+      json_file = argv[++a];
+    } else if (arg == "--label") {
+      label = argv[++a];
+    } else {
+      std::cerr << "Unknown option " << arg << std::endl;
+      return 1;
+    }
+  }
+  const int count = width * height;
+
+  // Scene for first_hit / shading / camera rays
+  Camera camera;
+  std::vector< std::shared_ptr<Object> > objects;
+  std::vector< std::shared_ptr<Light> > lights;
+  if (!read_json(scene_file, camera, objects, lights)) {
+    std::cerr << "Could not read " << scene_file << std::endl;
+    return 1;
+  }
+  BVH bvh;
+  bvh.build(objects);
+  CompiledScene scene;
+  scene.build(objects);
+  AABB scene_box = bvh.bounds();
+  if (scene_box.empty()) {
+    scene_box.insert(Eigen::Vector3d(-1,-1,-1));
+    scene_box.insert(Eigen::Vector3d( 1, 1, 1));
+  }
+
+  // Largest sphere set of the scene (read_json coalesces sphere runs) for
+  // SphereSet::intersect
+  std::shared_ptr<SphereSet> sphere_set;
+  for (const auto & object : objects) {
+    auto candidate = std::dynamic_pointer_cast<SphereSet>(object);
+    if (candidate &&
+        (!sphere_set || candidate->num_spheres() > sphere_set->num_spheres())) {
+      sphere_set = candidate;
+    }
+  }
+  if (!sphere_set) {
+    std::cerr << "No sphere set in " << scene_file
+              << ", skipping SphereSet::intersect" << std::endl;
+  }
+
+  // Largest mesh of the mesh scene for TriangleSoup::intersect
+  Camera mesh_camera;
+  std::vector< std::shared_ptr<Object> > mesh_objects;
+  std::vector< std::shared_ptr<Light> > mesh_lights;
+  std::shared_ptr<TriangleSoup> soup;
+  if (read_json(mesh_scene_file, mesh_camera, mesh_objects, mesh_lights)) {
+    for (const auto & object : mesh_objects) {
+      auto candidate = std::dynamic_pointer_cast<TriangleSoup>(object);
+      if (candidate &&
+          (!soup || candidate->num_faces() > soup->num_faces())) {
+        soup = candidate;
+      }
+    }
+  }
+  if (!soup) {
+    std::cerr << "No triangle soup in " << mesh_scene_file
+              << ", skipping TriangleSoup::intersect" << std::endl;
+  }
+
+  // Single primitives around the origin
+  Sphere sphere;
+  sphere.center = Eigen::Vector3d(0,0,0);
+  sphere.radius = 1.0;
+  Plane plane;
+  plane.point = Eigen::Vector3d(0,0,0);
+  plane.normal = Eigen::Vector3d(0,0.6,0.8);
+  Triangle triangle;
+  triangle.corners = std::make_tuple(
+    Eigen::Vector3d(-1,-1,0), Eigen::Vector3d(1,-1,0), Eigen::Vector3d(0,1,0));
+
+  // Pre-generated ray sets
+  const std::vector<Ray> primitive_coherent =
+    grid_rays(Eigen::Vector3d(0,0,3), 1.5, width, height);
+  const std::vector<Ray> primitive_incoherent =
+    random_primitive_rays(count, 1);
+  const std::vector<Ray> scene_coherent = camera_rays(camera, width, height);
+  const std::vector<Ray> scene_incoherent = random_rays(scene_box, count, 2);
+  std::vector<Ray> mesh_coherent, mesh_incoherent;
+  if (soup) {
+    AABB mesh_box;
+    soup->bounding_box(mesh_box);
+    mesh_coherent = camera_rays(mesh_camera, width, height);
+    mesh_incoherent = random_rays(mesh_box, count, 3);
+  }
+
+  std::vector<KernelResult> results;
+  auto primitive_kernel = [&](
+    const std::string & name, const Object & object)
+  {
+    const std::vector<Ray> * sets[2] = {&primitive_coherent, &primitive_incoherent};
+    const char * set_names[2] = {"coherent", "incoherent"};
+    for (int s = 0; s < 2; ++s) {
+      const std::vector<Ray> & rays = *sets[s];
+      results.push_back(run_kernel(name, set_names[s], count, repeat,
+        [&](const int k) {
+          double t; Eigen::Vector3d n;
+          const bool hit = object.intersect(rays[k], 0.0, t, n);
+          if (hit) g_sink = g_sink + t;
+          return hit ? 1 : 0;
+        }));
+    }
+  };
+  primitive_kernel("Sphere::intersect", sphere);
+  primitive_kernel("Plane::intersect", plane);
+  primitive_kernel("Triangle::intersect", triangle);
+
+  // Hierarchy-based kernels run in double, then in single precision (on
+  // copies, see Object::single_precision_copy)
+  const char * precision_suffix[2] = {"", " (float)"};
+  SinglePrecisionCopies copies;
+
+  if (sphere_set) {
+    // Same camera / random rays as first_hit, against the set alone
+    const std::vector<Ray> * sets[2] = {&scene_coherent, &scene_incoherent};
+    const double min_ts[2] = {1.0, 0.0};
+    const char * set_names[2] = {"coherent", "incoherent"};
+    for (int p = 0; p < 2; ++p) {
+      const Object & set = p == 1 ?
+        *single_precision_object(sphere_set, copies) : *sphere_set;
+      for (int s = 0; s < 2; ++s) {
+        const std::vector<Ray> & rays = *sets[s];
+        results.push_back(run_kernel(
+          std::string("SphereSet::intersect") + precision_suffix[p],
+          set_names[s], count, repeat, [&](const int k) {
+            double t; Eigen::Vector3d n;
+            const bool hit = set.intersect(rays[k], min_ts[s], t, n);
+            if (hit) g_sink = g_sink + t;
+            return hit ? 1 : 0;
+          }));
+      }
+    }
+  }
+
+  if (soup) {
+    const std::vector<Ray> * sets[2] = {&mesh_coherent, &mesh_incoherent};
+    const double min_ts[2] = {1.0, 0.0};
+    const char * set_names[2] = {"coherent", "incoherent"};
+    for (int p = 0; p < 2; ++p) {
+      const Object & mesh = p == 1 ?
+        *single_precision_object(soup, copies) : *soup;
+      for (int s = 0; s < 2; ++s) {
+        const std::vector<Ray> & rays = *sets[s];
+        results.push_back(run_kernel(
+          std::string("TriangleSoup::intersect") + precision_suffix[p],
+          set_names[s], count, repeat, [&](const int k) {
+            double t; Eigen::Vector3d n;
+            const bool hit = mesh.intersect(rays[k], min_ts[s], t, n);
+            if (hit) g_sink = g_sink + t;
+            return hit ? 1 : 0;
+          }));
+      }
+    }
+  }
+
+  // first_hit (through Object, and compiled) and shading over the whole scene
+  {
+    const std::vector<Ray> * sets[2] = {&scene_coherent, &scene_incoherent};
+    const double min_ts[2] = {1.0, 0.0};
+    const char * set_names[2] = {"coherent", "incoherent"};
+    for (int s = 0; s < 2; ++s) {
+      const std::vector<Ray> & rays = *sets[s];
+      results.push_back(run_kernel("first_hit", set_names[s], count, repeat,
+        [&](const int k) {
+          int id, part; double t; Eigen::Vector3d n;
+          const bool hit =
+            first_hit(rays[k], min_ts[s], objects, bvh, id, part, t, n);
+          if (hit) g_sink = g_sink + t;
+          return hit ? 1 : 0;
+        }));
+      for (int p = 0; p < 2; ++p) {
+        scene.build(objects, true, p == 1);
+        results.push_back(run_kernel(
+          std::string("CompiledScene::first_hit") + precision_suffix[p],
+          set_names[s], count, repeat, [&](const int k) {
+            int id, part; double t; Eigen::Vector3d n;
+            const bool hit =
+              scene.first_hit(rays[k], min_ts[s], id, part, t, n);
+            if (hit) g_sink = g_sink + t;
+            return hit ? 1 : 0;
+          }));
+      }
+      scene.build(objects);
+
+      // Shade the hits of this ray set
+      std::vector<int> hit_ids;
+      std::vector<int> hit_parts;
+      std::vector<double> hit_ts;
+      std::vector<Eigen::Vector3d> hit_ns;
+      std::vector<int> hit_rays;
+      for (int k = 0; k < count; ++k) {
+        int id, part; double t; Eigen::Vector3d n;
+        if (scene.first_hit(rays[k], min_ts[s], id, part, t, n)) {
+          hit_ids.push_back(id);
+          hit_parts.push_back(part);
+          hit_ts.push_back(t);
+          hit_ns.push_back(n);
+          hit_rays.push_back(k);
+        }
+      }
+      results.push_back(run_kernel("blinn_phong_shading", set_names[s],
+        static_cast<int>(hit_ids.size()), repeat, [&](const int k) {
+          const Eigen::Vector3d rgb = blinn_phong_shading(
+            rays[hit_rays[k]], hit_ids[k], hit_parts[k], hit_ts[k], hit_ns[k],
+            objects, scene, lights);
+          g_sink = g_sink + rgb(0);
+          return -1;
+        }));
+    }
+  }
+
+  // Camera ray generation (thin lens)
+  {
+    Camera lens_camera = camera;
+    if (lens_camera.aperture <= 0.0) lens_camera.aperture = 0.1;
+    results.push_back(run_kernel("viewing_ray_dof", "coherent", count, repeat,
+      [&](const int k) {
+        const int i = k / width;
+        const int j = k % width;
+        const Sampler sampler(0, i, j, 0);
+        Ray ray;
+        viewing_ray_dof(lens_camera, i, j, width, height,
+          sampler.uniform(SAMPLE_PIXEL_X), sampler.uniform(SAMPLE_PIXEL_Y),
+          sampler.uniform(SAMPLE_LENS_U), sampler.uniform(SAMPLE_LENS_V), ray);
+        g_sink = g_sink + ray.direction(0);
+        return -1;
+      }));
+  }
+
+  // Report
+  std::cout << std::left << std::setw(34) << "kernel"
+            << std::setw(12) << "rays"
+            << std::right << std::setw(10) << "count"
+            << std::setw(12) << "ns/ray"
+            << std::setw(14) << "Mrays/s"
+            << std::setw(10) << "hit rate" << std::endl;
+  nlohmann::json json_results = nlohmann::json::array();
+  for (const KernelResult & r : results) {
+    const double ns_per_ray = r.count > 0 ? r.seconds * 1e9 / r.count : 0.0;
+    const double rays_per_second = r.seconds > 0 ? r.count / r.seconds : 0.0;
+    std::cout << std::left << std::setw(34) << r.kernel
+              << std::setw(12) << r.rays
+              << std::right << std::setw(10) << r.count
+              << std::setw(12) << std::fixed << std::setprecision(2) << ns_per_ray
+              << std::setw(14) << rays_per_second / 1e6;
+    if (r.hits >= 0 && r.count > 0) {
+      std::cout << std::setw(10) << double(r.hits) / r.count;
+    } else {
+      std::cout << std::setw(10) << "-";
+    }
+    std::cout << std::defaultfloat << std::endl;
+
+    nlohmann::json entry;
+    entry["kernel"] = r.kernel;
+    entry["rays"] = r.rays;
+    entry["count"] = r.count;
+    entry["ns_per_ray"] = ns_per_ray;
+    entry["rays_per_second"] = rays_per_second;
+    if (r.hits >= 0 && r.count > 0) {
+      entry["hit_rate"] = double(r.hits) / r.count;
+    } else {
+      entry["hit_rate"] = nullptr;
+    }
+    json_results.push_back(entry);
+  }
+
+  if (!json_file.empty()) {
+    nlohmann::json j;
+    j["label"] = label;
+    j["scene"] = scene_file;
+    j["mesh_scene"] = mesh_scene_file;
+    j["width"] = width;
+    j["height"] = height;
+    j["repeat"] = repeat;
+    j["results"] = json_results;
+    std::ofstream out(json_file);
+    if (!out) {
+      std::cerr << "Could not write " << json_file << std::endl;
+      return 1;
+    }
+    out << j.dump(2) << std::endl;
+    std::cout << "Results written to " << json_file << std::endl;
+  }
+  return 0;
+}
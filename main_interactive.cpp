@@ -6,15 +6,19 @@
 #include <vector>
 #include <memory>
 #include <cstdlib>
+#include <chrono>
+#include <cmath>
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 
 #include "Camera.h"
 #include "Object.h"
 #include "Light.h"
 #include "read_json.h"
-#include "raycolor.h"
-#include "viewing_ray_dof.h"
-#include "viewing_ray.h"
+#include "CompiledScene.h"
+#include "ProgressiveRenderer.h"
+#include "ThreadPool.h"
+#include "dof_preview.h"
 #include "post_process.h"
 
 // Render state
@@ -25,11 +29,54 @@ struct RenderState {
   bool enable_vignette = true;
   bool enable_grading = true;
   int samples_per_pixel = 8;  // Lower for interactive speed
-  bool needs_render = true;
+  unsigned seed = 42;  // Frame seed for lens samples
+  bool enable_jitter = true;  // Sub-pixel jitter (anti-aliasing)
+  bool enable_focus_preview = true;  // Blur a pinhole frame while adjusting the lens
+  bool needs_render = true;  // Restart accumulation
+  bool needs_focus = false;  // Only aperture/focal distance changed
+  bool needs_samples = false;  // Only samples_per_pixel changed
+  bool needs_post = false;  // Only post-processing changed (no tracing)
+
+  // Camera navigation input since the last frame (applied by the main loop)
+  bool orbiting = false;  // Left button held
+  bool panning = false;  // Right/middle button (or shift+left) held
+  double cursor_x = 0.0, cursor_y = 0.0;
+  double orbit_dx = 0.0, orbit_dy = 0.0;  // Cursor travel while orbiting
+  double pan_dx = 0.0, pan_dy = 0.0;  // Cursor travel while panning
+  double dolly = 0.0;  // Scroll wheel steps (positive = forward)
+  bool reset_camera = false;
 };
 
 RenderState g_state;
 
+// What the background renderer is working on
+enum class ViewerPhase {
+  PINHOLE,  // One pinhole sample per pixel with depths, to preview lens changes
+  FOCUS,    // Nothing: the lens is being adjusted over a blurred pinhole frame
+  FULL      // The path-traced frame, refining
+};
+
+// Time without lens changes after which the path-traced frame takes over
+const double FOCUS_IDLE_SECONDS = 0.3;
+// Time without input after which frames are traced at full resolution again
+const double INPUT_IDLE_SECONDS = 0.5;
+// Smallest fraction of the window resolution traced while interacting
+const double MIN_RENDER_SCALE = 0.25;
+
+// Number of pixels along a side traced at render scale `scale`
+int scaled_size(int size, double scale) {
+  return std::max(1, (int)std::lround(size * scale));
+}
+
+// Flag a lens change: previewed if possible, otherwise re-traced
+void lens_changed() {
+  if (g_state.enable_focus_preview) {
+    g_state.needs_focus = true;
+  } else {
+    g_state.needs_render = true;
+  }
+}
+
 
 // Framebuffer size callback
 void framebuffer_size_callback(GLFWwindow* window, int fb_width, int fb_height) {
@@ -37,6 +84,44 @@ void framebuffer_size_callback(GLFWwindow* window, int fb_width, int fb_height)
   glViewport(0, 0, fb_width, fb_height);
 }
 
+// Mouse button callback: start or end an orbit/pan drag
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods) {
+  const bool pressed = (action == GLFW_PRESS);
+  if (pressed) {
+    glfwGetCursorPos(window, &g_state.cursor_x, &g_state.cursor_y);
+  }
+  if (button == GLFW_MOUSE_BUTTON_LEFT && !(pressed && (mods & GLFW_MOD_SHIFT))) {
+    g_state.orbiting = pressed;
+    if (!pressed) g_state.panning = false;
+  } else if (button == GLFW_MOUSE_BUTTON_LEFT ||
+             button == GLFW_MOUSE_BUTTON_RIGHT ||
+             button == GLFW_MOUSE_BUTTON_MIDDLE) {
+    g_state.panning = pressed;
+  }
+}
+
+// Cursor callback: accumulate drag travel
+void cursor_pos_callback(GLFWwindow* window, double x, double y) {
+  (void)window;
+  const double dx = x - g_state.cursor_x;
+  const double dy = y - g_state.cursor_y;
+  g_state.cursor_x = x;
+  g_state.cursor_y = y;
+  if (g_state.orbiting) {
+    g_state.orbit_dx += dx;
+    g_state.orbit_dy += dy;
+  } else if (g_state.panning) {
+    g_state.pan_dx += dx;
+    g_state.pan_dy += dy;
+  }
+}
+
+// Scroll callback: dolly toward or away from the focal point
+void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
+  (void)window; (void)xoffset;
+  g_state.dolly += yoffset;
+}
+
 // Keyboard callback
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
   (void)scancode; (void)mods;
@@ -48,49 +133,63 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         break;
       case GLFW_KEY_UP:
         g_state.aperture += 0.02;
-        g_state.needs_render = true;
+        lens_changed();
         std::cout << "Aperture: " << g_state.aperture << std::endl;
         break;
       case GLFW_KEY_DOWN:
         g_state.aperture = std::max(0.0, g_state.aperture - 0.02);
-        g_state.needs_render = true;
+        lens_changed();
         std::cout << "Aperture: " << g_state.aperture << std::endl;
         break;
       case GLFW_KEY_RIGHT:
         g_state.focal_distance += 0.2;
-        g_state.needs_render = true;
+        lens_changed();
         std::cout << "Focal distance: " << g_state.focal_distance << std::endl;
         break;
       case GLFW_KEY_LEFT:
         g_state.focal_distance = std::max(0.1, g_state.focal_distance - 0.2);
-        g_state.needs_render = true;
+        lens_changed();
         std::cout << "Focal distance: " << g_state.focal_distance << std::endl;
         break;
       case GLFW_KEY_G:
         g_state.enable_grain = !g_state.enable_grain;
-        g_state.needs_render = true;
+        g_state.needs_post = true;
         std::cout << "Film grain: " << (g_state.enable_grain ? "ON" : "OFF") << std::endl;
         break;
       case GLFW_KEY_V:
         g_state.enable_vignette = !g_state.enable_vignette;
-        g_state.needs_render = true;
+        g_state.needs_post = true;
         std::cout << "Vignette: " << (g_state.enable_vignette ? "ON" : "OFF") << std::endl;
         break;
       case GLFW_KEY_C:
         g_state.enable_grading = !g_state.enable_grading;
-        g_state.needs_render = true;
+        g_state.needs_post = true;
         std::cout << "Color grading: " << (g_state.enable_grading ? "ON" : "OFF") << std::endl;
         break;
+      case GLFW_KEY_J:
+        g_state.enable_jitter = !g_state.enable_jitter;
+        g_state.needs_render = true;
+        std::cout << "Anti-aliasing jitter: " << (g_state.enable_jitter ? "ON" : "OFF") << std::endl;
+        break;
+      case GLFW_KEY_F:
+        g_state.enable_focus_preview = !g_state.enable_focus_preview;
+        g_state.needs_render = true;
+        std::cout << "Focus preview: " << (g_state.enable_focus_preview ? "ON" : "OFF") << std::endl;
+        break;
       case GLFW_KEY_Q:
         g_state.samples_per_pixel = std::max(1, g_state.samples_per_pixel / 2);
-        g_state.needs_render = true;
+        g_state.needs_samples = true;
         std::cout << "Samples: " << g_state.samples_per_pixel << std::endl;
         break;
       case GLFW_KEY_W:
         g_state.samples_per_pixel = std::min(128, g_state.samples_per_pixel * 2);
-        g_state.needs_render = true;
+        g_state.needs_samples = true;
         std::cout << "Samples: " << g_state.samples_per_pixel << std::endl;
         break;
+      case GLFW_KEY_H:
+        g_state.reset_camera = true;
+        std::cout << "Camera reset" << std::endl;
+        break;
       case GLFW_KEY_R:
         g_state.needs_render = true;
         std::cout << "Re-rendering..." << std::endl;
@@ -165,38 +264,99 @@ GLuint create_program(const std::string& vert_path, const std::string& frag_path
   return program;
 }
 
-// Render the scene
-void render_scene(
+// Apply the navigation input gathered by the callbacks to the camera frame.
+// The camera orbits around and dollies toward its focal point (the point
+// focal_distance ahead of the eye), which therefore stays in focus; panning
+// moves points on the focal plane along with the cursor.
+//
+// Inputs:
+//   camera  camera to move
+//   home  camera as loaded (restored by H)
+//   up  world up direction (orbiting keeps the horizon level)
+//   window_width  window width in screen coordinates (cursor units)
+// Outputs:
+//   camera  moved camera (orthonormal frame)
+// Returns true iff the camera moved
+bool navigate_camera(
   Camera& camera,
-  const std::vector<std::shared_ptr<Object>>& objects,
-  const std::vector<std::shared_ptr<Light>>& lights,
+  const Camera& home,
+  const Eigen::Vector3d& up,
+  int window_width)
+{
+  const double ORBIT_RADIANS_PER_PIXEL = 0.005;
+  const double DOLLY_FRACTION_PER_STEP = 0.1;
+  bool moved = false;
+
+  if (g_state.reset_camera) {
+    camera = home;
+    g_state.aperture = home.aperture;
+    g_state.focal_distance = home.focal_distance;
+    g_state.reset_camera = false;
+    moved = true;
+  }
+
+  const Eigen::Vector3d pivot = camera.e - g_state.focal_distance * camera.w;
+  if (g_state.orbit_dx != 0.0 || g_state.orbit_dy != 0.0) {
+    // Yaw around the world up, pitch around the camera's horizontal axis
+    const Eigen::Matrix3d rotation =
+      (Eigen::AngleAxisd(-g_state.orbit_dx * ORBIT_RADIANS_PER_PIXEL, up) *
+       Eigen::AngleAxisd(-g_state.orbit_dy * ORBIT_RADIANS_PER_PIXEL, camera.u)).toRotationMatrix();
+    const Eigen::Vector3d offset = rotation * (camera.e - pivot);
+    const Eigen::Vector3d w = offset.normalized();
+    // Stop short of looking straight up or down
+    if (std::abs(w.dot(up)) < 0.99) {
+      camera.e = pivot + offset;
+      camera.w = w;
+      camera.u = up.cross(w).normalized();
+      camera.v = w.cross(camera.u);
+      moved = true;
+    }
+    g_state.orbit_dx = g_state.orbit_dy = 0.0;
+  }
+
+  if (g_state.pan_dx != 0.0 || g_state.pan_dy != 0.0) {
+    // Size of a cursor step on the focal plane
+    const double step =
+      g_state.focal_distance * camera.width / camera.d / std::max(1, window_width);
+    camera.e += step * (-g_state.pan_dx * camera.u + g_state.pan_dy * camera.v);
+    g_state.pan_dx = g_state.pan_dy = 0.0;
+    moved = true;
+  }
+
+  if (g_state.dolly != 0.0) {
+    // Move the eye and keep the focal point where it is
+    double forward = DOLLY_FRACTION_PER_STEP * g_state.focal_distance * g_state.dolly;
+    forward = std::min(forward, g_state.focal_distance - 0.1);
+    camera.e -= forward * camera.w;
+    g_state.focal_distance -= forward;
+    g_state.dolly = 0.0;
+    moved = true;
+  }
+  return moved;
+}
+
+// Settings of the frame the viewer accumulates
+RenderSettings viewer_settings(int width, int height) {
+  RenderSettings settings;
+  settings.width = width;
+  settings.height = height;
+  settings.samples_per_pixel = g_state.samples_per_pixel;
+  settings.seed = g_state.seed;
+  settings.jitter = g_state.enable_jitter;
+  return settings;
+}
+
+// Apply the film look to the current estimate and convert it to 8 bits
+void resolve_image(
+  const std::vector<float>& radiance,
   int width, int height,
   std::vector<uint8_t>& rgb_image)
 {
-  camera.aperture = g_state.aperture;
-  camera.focal_distance = g_state.focal_distance;
-
+  rgb_image.resize(width * height * 3);
   for (int i = 0; i < height; ++i) {
     for (int j = 0; j < width; ++j) {
-      Eigen::Vector3d color(0, 0, 0);
-
-      for (int s = 0; s < g_state.samples_per_pixel; ++s) {
-        double u = (i + ((double)rand() / RAND_MAX)) / width;
-        double v = (j + ((double)rand() / RAND_MAX)) / height;
-
-        Ray ray;
-        if (camera.aperture > 0.0) {
-          viewing_ray_dof(camera, i, j, width, height, u, v, ray);
-        } else {
-          viewing_ray(camera, i, j, width, height, ray);
-        }
-
-        Eigen::Vector3d ray_color;
-        raycolor(ray, 1.0, objects, lights, 0, ray_color);
-        color += ray_color;
-      }
-
-      color /= g_state.samples_per_pixel;
+      int idx = (i * width + j) * 3;
+      Eigen::Vector3d color(radiance[idx + 0], radiance[idx + 1], radiance[idx + 2]);
 
       // Post-processing
       if (g_state.enable_grading) {
@@ -209,8 +369,6 @@ void render_scene(
         color = apply_film_grain(color, i, j, 0.05);
       }
 
-      // Flip Y for OpenGL texture
-      int idx = (i * width + j) * 3;
       rgb_image[idx + 0] = (uint8_t)std::min(255.0, std::max(0.0, color(0) * 255.0));
       rgb_image[idx + 1] = (uint8_t)std::min(255.0, std::max(0.0, color(1) * 255.0));
       rgb_image[idx + 2] = (uint8_t)std::min(255.0, std::max(0.0, color(2) * 255.0));
@@ -219,7 +377,17 @@ void render_scene(
 }
 
 int main(int argc, char* argv[]) {
-  std::string scene_file = argc > 1 ? argv[1] : "data/showcase.json";
+  // Usage: raytracing_interactive [scene.json] [--frame-budget MS]
+  std::string scene_file = "data/showcase.json";
+  double frame_budget_ms = 33.0;  // Pass time to hold while interacting
+  for (int a = 1; a < argc; ++a) {
+    const std::string arg = argv[a];
+    if (arg == "--frame-budget" && a + 1 < argc) {
+      frame_budget_ms = std::max(1.0, std::atof(argv[++a]));
+    } else {
+      scene_file = arg;
+    }
+  }
 
   // Initialize GLFW
   if (!glfwInit()) {
@@ -245,6 +413,9 @@ int main(int argc, char* argv[]) {
   glfwMakeContextCurrent(window);
   glfwSetKeyCallback(window, key_callback);
   glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+  glfwSetMouseButtonCallback(window, mouse_button_callback);
+  glfwSetCursorPosCallback(window, cursor_pos_callback);
+  glfwSetScrollCallback(window, scroll_callback);
 
   // Initialize GLAD
   if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
@@ -257,10 +428,19 @@ int main(int argc, char* argv[]) {
   std::vector<std::shared_ptr<Object>> objects;
   std::vector<std::shared_ptr<Light>> lights;
   read_json(scene_file, camera, objects, lights);
+  CompiledScene scene;
+  scene.build(objects);
 
   g_state.aperture = camera.aperture;
   g_state.focal_distance = camera.focal_distance;
 
+  // Navigation keeps the frame orthonormal, with the loaded up direction as
+  // the world up
+  const Eigen::Vector3d world_up = camera.v;
+  camera.u = world_up.cross(camera.w).normalized();
+  camera.v = camera.w.cross(camera.u);
+  const Camera home_camera = camera;
+
   std::cout << "\n========================================" << std::endl;
   std::cout << "  Film Camera Dreams - Interactive Mode" << std::endl;
   std::cout << "========================================\n" << std::endl;
@@ -270,9 +450,16 @@ int main(int argc, char* argv[]) {
   std::cout << "  G          - Toggle film grain" << std::endl;
   std::cout << "  V          - Toggle vignetting" << std::endl;
   std::cout << "  C          - Toggle color grading" << std::endl;
+  std::cout << "  J          - Toggle anti-aliasing jitter" << std::endl;
+  std::cout << "  F          - Toggle focus preview (blur while adjusting the lens)" << std::endl;
   std::cout << "  Q/W        - Decrease/Increase samples (quality)" << std::endl;
+  std::cout << "  Left drag  - Orbit around the focal point" << std::endl;
+  std::cout << "  Right drag - Pan (also middle drag or shift+left drag)" << std::endl;
+  std::cout << "  Scroll     - Dolly toward/away from the focal point" << std::endl;
+  std::cout << "  H          - Reset camera" << std::endl;
   std::cout << "  R          - Force re-render" << std::endl;
   std::cout << "  ESC        - Quit\n" << std::endl;
+  std::cout << "Frame budget while interacting: " << frame_budget_ms << " ms" << std::endl;
 
   // Create shader program
   GLuint program = create_program("shaders/display.vert", "shaders/display.frag");
@@ -313,29 +500,182 @@ int main(int argc, char* argv[]) {
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  // Scaled frames can have rows that are not a multiple of 4 bytes
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
   std::vector<uint8_t> rgb_image(width * height * 3, 0);
 
+  // Frames accumulate in the background; the loop below only shows them
+  ProgressiveRenderer renderer(objects, scene, lights);
+  std::vector<float> radiance, depth;
+  int frame_width = width, frame_height = height;
+  bool frame_done = true;
+  auto frame_start = std::chrono::steady_clock::now();
+
+  // Dynamic resolution: while the user interacts, frames are traced at the
+  // fraction of the window resolution whose passes fit the frame budget, and
+  // the texture is stretched over the window. Idle views return to full size.
+  double render_scale = 1.0;  // Scale for frames traced while interacting
+  double frame_scale = 1.0;  // Scale of the frame in flight
+  int shown_width = width, shown_height = height;  // Size of the texture
+  auto input_time = frame_start;
+  // Whether the frame in flight (or its focus preview) has been shown whole.
+  // Until it has, restarts wait up to two frame budgets, so a moving camera
+  // shows complete low-resolution frames instead of restarting every tile.
+  bool frame_shown = true;
+
+  // Lens changes re-blur the last pinhole frame instead of tracing
+  ThreadPool preview_pool;
+  std::vector<float> pinhole_radiance, pinhole_depth;
+  bool have_pinhole = false;
+  int pinhole_width = width, pinhole_height = height;
+  ViewerPhase phase = ViewerPhase::FULL;
+  auto lens_time = frame_start;
+
   // Set viewport to match actual framebuffer size
   int fb_width, fb_height;
   glfwGetFramebufferSize(window, &fb_width, &fb_height);
-  std::cout << "Render size: " << width << "x" << height << std::endl;
+  std::cout << "Render size: " << width << "x" << height
+            << " on " << renderer.num_threads() << " threads" << std::endl;
   std::cout << "Framebuffer size: " << fb_width << "x" << fb_height << std::endl;
   std::cout << "Camera image plane: " << camera.width << "x" << camera.height << std::endl;
   glViewport(0, 0, fb_width, fb_height);
 
   // Main loop
   while (!glfwWindowShouldClose(window)) {
-    if (g_state.needs_render) {
-      std::cout << "Rendering..." << std::flush;
-      render_scene(camera, objects, lights, width, height, rgb_image);
+    const auto now = std::chrono::steady_clock::now();
+    int window_width, window_height;
+    glfwGetWindowSize(window, &window_width, &window_height);
+    if (navigate_camera(camera, home_camera, world_up, window_width)) {
+      g_state.needs_render = true;
+    }
+    camera.aperture = g_state.aperture;
+    camera.focal_distance = g_state.focal_distance;
+    if (g_state.needs_render || g_state.needs_focus) {
+      input_time = now;
+    }
+    const bool interacting =
+      std::chrono::duration<double>(now - input_time).count() < INPUT_IDLE_SECONDS;
+    // A reduced frame is traced again at full size once input stops
+    if (!interacting && frame_scale < 1.0 && phase != ViewerPhase::FOCUS) {
+      g_state.needs_render = true;
+    }
+    // Settings of a frame traced at the current render scale
+    auto frame_settings = [&]() {
+      frame_scale = interacting ? render_scale : 1.0;
+      return viewer_settings(
+        scaled_size(width, frame_scale), scaled_size(height, frame_scale));
+    };
+
+    const bool hold_restart = !frame_shown &&
+      std::chrono::duration<double>(now - frame_start).count() * 1000.0 < 2.0 * frame_budget_ms;
+
+    bool new_image = false;
+    if (g_state.needs_render && !hold_restart) {
+      // Drops the frame in flight; the new one replaces it tile by tile
+      if (g_state.enable_focus_preview) {
+        Camera pinhole = camera;
+        pinhole.aperture = 0.0;
+        RenderSettings settings = frame_settings();
+        settings.jitter = false;
+        settings.samples_per_pixel = 1;
+        renderer.restart(pinhole, settings);
+        phase = ViewerPhase::PINHOLE;
+      } else {
+        renderer.restart(camera, frame_settings());
+        phase = ViewerPhase::FULL;
+      }
+      have_pinhole = false;
+      frame_start = now;
+      frame_done = false;
+      frame_shown = false;
+      g_state.needs_render = false;
+      g_state.needs_focus = false;
+      g_state.needs_samples = false;
+    } else if (g_state.needs_focus) {
+      // A pinhole frame in flight is blurred with the new lens once it is done
+      if (have_pinhole) {
+        renderer.cancel();
+        dof_preview(camera, pinhole_width, pinhole_height, pinhole_radiance, pinhole_depth, preview_pool, radiance);
+        frame_width = pinhole_width;
+        frame_height = pinhole_height;
+        new_image = true;
+        phase = ViewerPhase::FOCUS;
+        lens_time = now;
+      }
+      g_state.needs_focus = false;
+    } else if (g_state.needs_samples) {
+      // Keep the samples so far and refine (or stop) from there
+      if (phase == ViewerPhase::FULL) {
+        renderer.set_samples_per_pixel(g_state.samples_per_pixel);
+        frame_done = false;
+      }
+      g_state.needs_samples = false;
+    }
+
+    int samples = 0;
+    bool done = false;
+    if (phase == ViewerPhase::PINHOLE) {
+      if (renderer.snapshot(pinhole_radiance, pinhole_depth, pinhole_width, pinhole_height, samples, done) && done) {
+        // Show the preview, then path trace the lens for real
+        have_pinhole = true;
+        dof_preview(camera, pinhole_width, pinhole_height, pinhole_radiance, pinhole_depth, preview_pool, radiance);
+        frame_width = pinhole_width;
+        frame_height = pinhole_height;
+        new_image = true;
+        renderer.restart(camera, viewer_settings(pinhole_width, pinhole_height));
+        phase = ViewerPhase::FULL;
+        done = false;
+        frame_shown = true;
+      }
+    } else if (phase == ViewerPhase::FOCUS) {
+      if (std::chrono::duration<double>(now - lens_time).count() > FOCUS_IDLE_SECONDS) {
+        renderer.restart(camera, frame_settings());
+        frame_start = now;
+        frame_done = false;
+        phase = ViewerPhase::FULL;
+      }
+    } else {
+      new_image = renderer.snapshot(radiance, depth, frame_width, frame_height, samples, done);
+      // Keep showing the last image until a resized frame has a whole pass
+      if (new_image && samples == 0 &&
+          (frame_width != shown_width || frame_height != shown_height)) {
+        new_image = false;
+      }
+      if (new_image && samples > 0) {
+        frame_shown = true;
+      }
+    }
+
+    // Fit the cost of a pass to the frame budget (its cost scales with the
+    // number of pixels, i.e., the square of the scale)
+    if (new_image && samples > 0) {
+      const double pass_ms = 1000.0 * renderer.pass_seconds();
+      if (pass_ms > 0.0) {
+        const double fit = frame_scale * std::sqrt(frame_budget_ms / pass_ms);
+        render_scale = std::max(MIN_RENDER_SCALE, std::min(1.0, fit));
+      }
+    }
+
+    // Post effects are per-pixel functions of the radiance, so toggling one
+    // re-runs them on the last estimate instead of tracing again
+    if (new_image || (g_state.needs_post && !radiance.empty())) {
+      resolve_image(radiance, frame_width, frame_height, rgb_image);
+      g_state.needs_post = false;
+      shown_width = frame_width;
+      shown_height = frame_height;
 
       // Upload to texture
       glBindTexture(GL_TEXTURE_2D, texture);
-      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, rgb_image.data());
-
-      g_state.needs_render = false;
-      std::cout << " Done!" << std::endl;
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, frame_width, frame_height, 0, GL_RGB, GL_UNSIGNED_BYTE, rgb_image.data());
+
+      if (phase == ViewerPhase::FULL && done && !frame_done) {
+        const double seconds = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - frame_start).count();
+        std::cout << "Converged: " << samples << " samples/pixel in "
+                  << seconds << " s" << std::endl;
+        frame_done = true;
+      }
     }
 
     // Render quad with texture (with letterboxing to preserve aspect ratio)
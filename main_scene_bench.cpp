@@ -0,0 +1,412 @@
+// End-to-end scene benchmark
+//
+// Renders every scene in the data directory (or the scenes given on the
+// command line) at a fixed resolution, sample count and seed, and reports the
+// time spent reading the scene, building the BVH, rendering and writing the
+// PNG, the rays traced per second by kind and the peak resident set size.
+// Results can be written as JSON and compared against a stored baseline run,
+// failing (exit code 2) when a scene got slower or bigger than the thresholds
+// allow.
+
+#include "Object.h"
+#include "Camera.h"
+#include "Light.h"
+#include "read_json.h"
+#include "CompiledScene.h"
+#include "ThreadPool.h"
+#include "RayStats.h"
+#include "render_image.h"
+#include "write_png.h"
+#include <json.hpp>
+#include <Eigen/Core>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#ifdef _MSC_VER
+#pragma comment(lib, "psapi.lib")
+#endif
+#else
+#include <sys/resource.h>
+#endif
+
+// Measurements of one scene
+struct SceneResult
+{
+  std::string scene;
+  double read_seconds = 0;
+  double build_seconds = 0;
+  double render_seconds = 0;
+  double write_seconds = 0;
+  RayStats rays;
+  // Peak resident set size of the process after this scene, in bytes. This
+  // is a high-water mark over this and all earlier scenes; pass a single
+  // scene to measure it alone.
+  std::uint64_t peak_rss = 0;
+  // FNV-1a hash of the rendered 8-bit image
+  std::uint64_t image_hash = 0;
+
+  double wall_seconds() const
+  {
+    return read_seconds + build_seconds + render_seconds + write_seconds;
+  }
+};
+
+// Peak resident set size of this process so far, in bytes (0 if unknown)
+static std::uint64_t peak_rss_bytes()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return counters.PeakWorkingSetSize;
+  }
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return static_cast<std::uint64_t>(usage.ru_maxrss);
+#else
+  return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+static std::uint64_t fnv1a(const std::vector<unsigned char> & data)
+{
+  std::uint64_t hash = 0xcbf29ce484222325ull;
+  for (const unsigned char c : data) {
+    hash = (hash ^ c) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static std::string hex(const std::uint64_t value)
+{
+  char buffer[17];
+  std::snprintf(
+    buffer, sizeof(buffer), "%016llx", static_cast<unsigned long long>(value));
+  return buffer;
+}
+
+static double seconds_since(const std::chrono::steady_clock::time_point & start)
+{
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+static double per_second(const std::uint64_t count, const double seconds)
+{
+  return seconds > 0 ? count / seconds : 0.0;
+}
+
+int main(int argc, char * argv[])
+{
+  // Usage: raytracing_scene_bench [scene.json ...] [--data-dir DIR]
+  //   [--width W] [--height H] [--spp N] [--seed S] [--threads N]
+  //   [--packet 1|2|4|8] [--precision double|float]
+  //   [--repeat R] [--png-dir DIR] [--json out.json] [--label L]
+  //   [--baseline base.json] [--time-threshold X] [--rss-threshold X]
+  std::vector<std::string> scene_files;
+  std::string data_dir = "../data";
+  std::string png_dir = ".";
+  std::string json_file;
+  std::string baseline_file;
+  std::string label;
+  RenderSettings settings;
+  settings.width = 320;
+  settings.height = 180;
+  settings.samples_per_pixel = 4;
+  int num_threads = 0;
+  int repeat = 1;
+  bool single_precision = false;
+  // Allowed relative increase over the baseline before a scene counts as a
+  // regression
+  double time_threshold = 0.10;
+  double rss_threshold = 0.25;
+  for (int a = 1; a < argc; ++a) {
+    const std::string arg = argv[a];
+    if (arg.size() < 2 || arg.compare(0, 2, "--") != 0) {
+      scene_files.push_back(arg);
+      continue;
+    }
+    if (a + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << std::endl;
+      return 1;
+    }
+    if (arg == "--data-dir") {
+      data_dir = argv[++a];
+    } else if (arg == "--width") {
+      settings.width = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--height") {
+      settings.height = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--spp") {
+      settings.samples_per_pixel = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--seed") {
+      settings.seed = static_cast<unsigned>(std::strtoul(argv[++a], nullptr, 10));
+    } else if (arg == "--threads") {
+      num_threads = std::atoi(argv[++a]);
+    } else if (arg == "--packet") {
+      settings.packet_size = std::atoi(argv[++a]);
+      if (settings.packet_size != 1 && settings.packet_size != 2 &&
+          settings.packet_size != 4 && settings.packet_size != 8) {
+        std::cerr << "--packet must be 1, 2, 4 or 8" << std::endl;
+        return 1;
+      }
+    } else if (arg == "--precision") {
+      const std::string precision = argv[++a];
+      if (precision != "double" && precision != "float") {
+        std::cerr << "--precision must be double or float" << std::endl;
+        return 1;
+      }
+      single_precision = precision == "float";
+    } else if (arg == "--repeat") {
+      repeat = std::max(1, std::atoi(argv[++a]));
+    } else if (arg == "--png-dir") {
+      png_dir = argv[++a];
+    } else if (arg == "--json") {
+      json_file = argv[++a];
+    } else if (arg == "--label") {
+      label = argv[++a];
+    } else if (arg == "--baseline") {
+      baseline_file = argv[++a];
+    } else if (arg == "--time-threshold") {
+      time_threshold = std::atof(argv[++a]);
+    } else if (arg == "--rss-threshold") {
+      rss_threshold = std::atof(argv[++a]);
+    } else {
+      std::cerr << "Unknown option " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  if (scene_files.empty()) {
+    std::error_code error;
+    for (const auto & entry :
+        std::filesystem::directory_iterator(data_dir, error)) {
+      if (entry.is_regular_file() && entry.path().extension() == ".json") {
+        scene_files.push_back(entry.path().string());
+      }
+    }
+    std::sort(scene_files.begin(), scene_files.end());
+    if (scene_files.empty()) {
+      std::cerr << "No scenes found in " << data_dir << std::endl;
+      return 1;
+    }
+  }
+
+  ThreadPool pool(num_threads);
+  std::cout << "Rendering " << scene_files.size() << " scenes at "
+            << settings.width << "x" << settings.height << " with "
+            << settings.samples_per_pixel << " samples/pixel (seed "
+            << settings.seed << ") on " << pool.size() << " threads in "
+            << (single_precision ? "single" : "double") << " precision"
+            << std::endl;
+
+  std::vector<SceneResult> results;
+  for (const std::string & scene_file : scene_files) {
+    const std::string name = std::filesystem::path(scene_file).stem().string();
+    // Keep the run with the least wall time
+    SceneResult best;
+    for (int r = 0; r < repeat; ++r) {
+      SceneResult result;
+      result.scene = name;
+
+      Camera camera;
+      std::vector< std::shared_ptr<Object> > objects;
+      std::vector< std::shared_ptr<Light> > lights;
+      auto start = std::chrono::steady_clock::now();
+      if (!read_json(scene_file, camera, objects, lights)) {
+        std::cerr << "Could not read " << scene_file << std::endl;
+        return 1;
+      }
+      result.read_seconds = seconds_since(start);
+
+      start = std::chrono::steady_clock::now();
+      CompiledScene scene;
+      scene.build(objects, true, single_precision);
+      result.build_seconds = seconds_since(start);
+
+      std::vector<unsigned char> rgb_image;
+      start = std::chrono::steady_clock::now();
+      render_image(
+        camera, objects, scene, lights, settings, pool, rgb_image, result.rays);
+      result.render_seconds = seconds_since(start);
+
+      const std::string png_file =
+        (std::filesystem::path(png_dir) / (name + ".png")).string();
+      start = std::chrono::steady_clock::now();
+      if (!write_png(png_file, rgb_image, settings.width, settings.height)) {
+        std::cerr << "Could not write " << png_file << std::endl;
+        return 1;
+      }
+      result.write_seconds = seconds_since(start);
+
+      result.image_hash = fnv1a(rgb_image);
+      result.peak_rss = peak_rss_bytes();
+      if (r == 0 || result.wall_seconds() < best.wall_seconds()) {
+        best = result;
+      }
+    }
+    results.push_back(best);
+  }
+
+  // Report
+  std::cout << std::left << std::setw(24) << "scene"
+            << std::right << std::setw(10) << "wall s"
+            << std::setw(10) << "read s"
+            << std::setw(10) << "bvh s"
+            << std::setw(10) << "render s"
+            << std::setw(10) << "png s"
+            << std::setw(12) << "primary/s"
+            << std::setw(12) << "shadow/s"
+            << std::setw(12) << "reflect/s"
+            << std::setw(10) << "RSS MB" << std::endl;
+  nlohmann::json json_scenes = nlohmann::json::array();
+  for (const SceneResult & r : results) {
+    std::cout << std::left << std::setw(24) << r.scene
+              << std::right << std::fixed << std::setprecision(3)
+              << std::setw(10) << r.wall_seconds()
+              << std::setw(10) << r.read_seconds
+              << std::setw(10) << r.build_seconds
+              << std::setw(10) << r.render_seconds
+              << std::setw(10) << r.write_seconds
+              << std::setprecision(2)
+              << std::setw(11) << per_second(r.rays.primary, r.render_seconds) / 1e6 << "M"
+              << std::setw(11) << per_second(r.rays.shadow, r.render_seconds) / 1e6 << "M"
+              << std::setw(11) << per_second(r.rays.reflection, r.render_seconds) / 1e6 << "M"
+              << std::setw(10) << r.peak_rss / (1024.0 * 1024.0)
+              << std::defaultfloat << std::endl;
+
+    nlohmann::json entry;
+    entry["scene"] = r.scene;
+    entry["wall_seconds"] = r.wall_seconds();
+    entry["read_json_seconds"] = r.read_seconds;
+    entry["bvh_build_seconds"] = r.build_seconds;
+    entry["render_seconds"] = r.render_seconds;
+    entry["write_png_seconds"] = r.write_seconds;
+    entry["primary_rays"] = r.rays.primary;
+    entry["shadow_rays"] = r.rays.shadow;
+    entry["reflection_rays"] = r.rays.reflection;
+    entry["primary_rays_per_second"] = per_second(r.rays.primary, r.render_seconds);
+    entry["shadow_rays_per_second"] = per_second(r.rays.shadow, r.render_seconds);
+    entry["reflection_rays_per_second"] =
+      per_second(r.rays.reflection, r.render_seconds);
+    entry["rays_per_second"] = per_second(r.rays.total(), r.render_seconds);
+    entry["peak_rss_bytes"] = r.peak_rss;
+    entry["image_hash"] = hex(r.image_hash);
+    json_scenes.push_back(entry);
+  }
+
+  nlohmann::json run;
+  run["label"] = label;
+  run["width"] = settings.width;
+  run["height"] = settings.height;
+  run["samples_per_pixel"] = settings.samples_per_pixel;
+  run["seed"] = settings.seed;
+  run["threads"] = pool.size();
+  run["packet_size"] = settings.packet_size;
+  run["precision"] = single_precision ? "float" : "double";
+  run["repeat"] = repeat;
+  run["scenes"] = json_scenes;
+  if (!json_file.empty()) {
+    std::ofstream out(json_file);
+    if (!out) {
+      std::cerr << "Could not write " << json_file << std::endl;
+      return 1;
+    }
+    out << run.dump(2) << std::endl;
+    std::cout << "Results written to " << json_file << std::endl;
+  }
+
+  if (baseline_file.empty()) {
+    return 0;
+  }
+
+  // Compare against the baseline run
+  nlohmann::json baseline;
+  {
+    std::ifstream in(baseline_file);
+    if (!in) {
+      std::cerr << "Could not read " << baseline_file << std::endl;
+      return 1;
+    }
+    in >> baseline;
+  }
+  // Only runs of the same configuration are comparable (timings depend on
+  // all of these)
+  for (const char * key : {
+        "width", "height", "samples_per_pixel", "seed", "threads",
+        "packet_size", "precision"}) {
+    if (baseline.value(key, nlohmann::json()) != run[key]) {
+      std::cerr << "Baseline " << baseline_file << " was run with a different "
+                << key << " (" << baseline.value(key, nlohmann::json()).dump()
+                << " vs " << run[key].dump() << ")" << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "Comparing against " << baseline_file
+            << " (thresholds: time +" << 100 * time_threshold << "%, RSS +"
+            << 100 * rss_threshold << "%)" << std::endl;
+  const nlohmann::json base_scenes =
+    baseline.value("scenes", nlohmann::json::array());
+  int regressions = 0;
+  for (const auto & entry : json_scenes) {
+    const std::string scene = entry["scene"];
+    const nlohmann::json * base = nullptr;
+    for (const auto & candidate : base_scenes) {
+      if (candidate.value("scene", "") == scene) {
+        base = &candidate;
+        break;
+      }
+    }
+    if (!base) {
+      std::cout << "  " << scene << ": not in baseline" << std::endl;
+      continue;
+    }
+    const double wall = entry["wall_seconds"];
+    const double base_wall = base->value("wall_seconds", 0.0);
+    const double rss = entry["peak_rss_bytes"];
+    const double base_rss = base->value("peak_rss_bytes", 0.0);
+    const bool slower = base_wall > 0 && wall > base_wall * (1.0 + time_threshold);
+    const bool bigger = base_rss > 0 && rss > base_rss * (1.0 + rss_threshold);
+    std::cout << "  " << std::left << std::setw(24) << scene << std::right
+              << std::fixed << std::setprecision(1)
+              << " time " << std::showpos
+              << (base_wall > 0 ? 100 * (wall / base_wall - 1) : 0.0) << "%"
+              << " RSS "
+              << (base_rss > 0 ? 100 * (rss / base_rss - 1) : 0.0) << "%"
+              << std::noshowpos << std::defaultfloat;
+    if (slower || bigger) {
+      std::cout << "  REGRESSION";
+      ++regressions;
+    }
+    if (base->value("image_hash", "") != entry["image_hash"]) {
+      std::cout << "  (image changed)";
+    }
+    std::cout << std::endl;
+  }
+  if (regressions > 0) {
+    std::cout << regressions << " scene(s) regressed" << std::endl;
+    return 2;
+  }
+  std::cout << "No regressions" << std::endl;
+  return 0;
+}
@@ -0,0 +1,310 @@
+#include "BVH.h"
+#include <algorithm>
+#include <cmath>
+
+// Number of SAH candidate buckets per axis
+static const int NUM_BINS = 16;
+// Leaves never hold more primitives than this (or than one block, if blocks
+// are larger)
+static const int MAX_LEAF_SIZE = 4;
+// Below this depth splits fall back to the median so the traversal stack in
+// BVH::traverse_leaves cannot overflow
+static const int MAX_SAH_DEPTH = 64;
+
+void BVH::build(const std::vector<std::shared_ptr<Object> > & objects)
+{
+  std::vector<AABB> boxes(objects.size());
+  for(int k = 0; k < static_cast<int>(objects.size()); ++k)
+  {
+    if(!objects[k]->bounding_box(boxes[k]))
+    {
+      boxes[k] = AABB();
+    }
+  }
+  build(boxes);
+}
+
+void BVH::build(const std::vector<AABB> & boxes, const int block_size)
+{
+  this->block_size = std::max(1, block_size);
+  nodes.clear();
+  wide_nodes.clear();
+  float_nodes.clear();
+  indices.clear();
+  unbounded.clear();
+
+  // Pad every box by a small relative amount so that rounding in primitive
+  // intersection routines never reports a hit outside its box.
+  std::vector<AABB> padded(boxes.size());
+  std::vector<Eigen::Vector3d> centroids(boxes.size());
+  indices.reserve(boxes.size());
+  for(int k = 0; k < static_cast<int>(boxes.size()); ++k)
+  {
+    if(boxes[k].empty())
+    {
+      unbounded.push_back(k);
+      continue;
+    }
+    const double scale =
+      boxes[k].min_corner.cwiseAbs().cwiseMax(
+        boxes[k].max_corner.cwiseAbs()).maxCoeff() +
+      (boxes[k].max_corner - boxes[k].min_corner).maxCoeff();
+    const Eigen::Vector3d pad = Eigen::Vector3d::Constant(1e-9 * scale + 1e-12);
+    padded[k].min_corner = boxes[k].min_corner - pad;
+    padded[k].max_corner = boxes[k].max_corner + pad;
+    centroids[k] = padded[k].center();
+    indices.push_back(k);
+  }
+  if(indices.empty()) return;
+  nodes.reserve(2 * indices.size());
+  build_recursive(padded, centroids, 0, static_cast<int>(indices.size()), 0);
+  // Leaves hold several primitives, so far fewer nodes than reserved
+  nodes.shrink_to_fit();
+
+  wide_nodes.clear();
+  wide_nodes.reserve(nodes.size() / 2 + 1);
+  if(nodes[0].count > 0)
+  {
+    // A single leaf: wrap it in a root with one child
+    WideNode root;
+    for(int c = 0; c < WideNode::WIDTH; ++c)
+    {
+      for(int a = 0; a < 3; ++a)
+      {
+        root.min_corner[a][c] = nodes[0].box.min_corner(a);
+        root.max_corner[a][c] = nodes[0].box.max_corner(a);
+      }
+      root.child[c] = 0;
+    }
+    root.leaf_mask = 1;
+    root.num_children = 1;
+    wide_nodes.push_back(root);
+  }else
+  {
+    collapse(0);
+  }
+  wide_nodes.shrink_to_fit();
+  set_single_precision(single);
+}
+
+void BVH::set_single_precision(const bool single)
+{
+  this->single = single;
+  float_nodes.clear();
+  if(!single) return;
+  float_nodes.resize(wide_nodes.size());
+  for(int k = 0; k < static_cast<int>(wide_nodes.size()); ++k)
+  {
+    const WideNode & node = wide_nodes[k];
+    FloatWideNode & float_node = float_nodes[k];
+    for(int a = 0; a < 3; ++a)
+    {
+      for(int c = 0; c < WideNode::WIDTH; ++c)
+      {
+        float_node.min_corner[a][c] = round_down_float(node.min_corner[a][c]);
+        float_node.max_corner[a][c] = round_up_float(node.max_corner[a][c]);
+      }
+    }
+    for(int c = 0; c < WideNode::WIDTH; ++c)
+    {
+      float_node.child[c] = node.child[c];
+    }
+    float_node.leaf_mask = node.leaf_mask;
+    float_node.num_children = node.num_children;
+  }
+}
+
+int BVH::build_recursive(
+  const std::vector<AABB> & boxes,
+  const std::vector<Eigen::Vector3d> & centroids,
+  const int begin,
+  const int end,
+  const int depth)
+{
+  const int node_id = static_cast<int>(nodes.size());
+  nodes.emplace_back();
+
+  AABB box, centroid_box;
+  for(int k = begin; k < end; ++k)
+  {
+    box.insert(boxes[indices[k]]);
+    centroid_box.insert(centroids[indices[k]]);
+  }
+  nodes[node_id].box = box;
+
+  const int count = end - begin;
+  // Intersection tests needed for n primitives
+  auto num_tests = [&](const int n)
+  {
+    return static_cast<double>((n + block_size - 1) / block_size);
+  };
+  auto make_leaf = [&]()
+  {
+    nodes[node_id].offset = begin;
+    nodes[node_id].count = count;
+    return node_id;
+  };
+  if(count == 1) return make_leaf();
+
+  const Eigen::Vector3d extent =
+    centroid_box.max_corner - centroid_box.min_corner;
+
+  // Evaluate the binned SAH on all three axes
+  int best_axis = -1;
+  int best_bin = -1;
+  double best_cost = std::numeric_limits<double>::infinity();
+  if(depth < MAX_SAH_DEPTH)
+  {
+    for(int a = 0; a < 3; ++a)
+    {
+      if(!(extent(a) > 0.0)) continue;
+      AABB bin_box[NUM_BINS];
+      int bin_count[NUM_BINS] = {0};
+      const double bin_scale = NUM_BINS / extent(a);
+      for(int k = begin; k < end; ++k)
+      {
+        const int b = std::min(NUM_BINS - 1, static_cast<int>(
+          (centroids[indices[k]](a) - centroid_box.min_corner(a)) * bin_scale));
+        bin_box[b].insert(boxes[indices[k]]);
+        bin_count[b]++;
+      }
+      // Sweep from the right to get the cost of every right-hand side
+      double right_area[NUM_BINS];
+      int right_count[NUM_BINS];
+      AABB acc;
+      int acc_count = 0;
+      for(int b = NUM_BINS - 1; b > 0; --b)
+      {
+        acc.insert(bin_box[b]);
+        acc_count += bin_count[b];
+        right_area[b] = acc.surface_area();
+        right_count[b] = acc_count;
+      }
+      acc = AABB();
+      acc_count = 0;
+      for(int b = 1; b < NUM_BINS; ++b)
+      {
+        acc.insert(bin_box[b - 1]);
+        acc_count += bin_count[b - 1];
+        if(acc_count == 0 || right_count[b] == 0) continue;
+        const double cost =
+          acc.surface_area() * num_tests(acc_count) +
+          right_area[b] * num_tests(right_count[b]);
+        if(cost < best_cost)
+        {
+          best_cost = cost;
+          best_axis = a;
+          best_bin = b;
+        }
+      }
+    }
+  }
+
+  // Relative cost of traversing a node vs. intersecting a primitive (or a
+  // block of them) is 1:1
+  const double leaf_cost = num_tests(count);
+  const double area = box.surface_area();
+  if(best_axis >= 0 && area > 0.0)
+  {
+    best_cost = 1.0 + best_cost / area;
+  }
+  if(count <= std::max(MAX_LEAF_SIZE, block_size) && !(best_cost < leaf_cost))
+  {
+    return make_leaf();
+  }
+
+  int mid;
+  int axis;
+  if(best_axis >= 0)
+  {
+    axis = best_axis;
+    const double bin_scale = NUM_BINS / extent(axis);
+    const double lo = centroid_box.min_corner(axis);
+    mid = static_cast<int>(std::partition(
+      indices.begin() + begin, indices.begin() + end,
+      [&](const int id)
+      {
+        const int b = std::min(NUM_BINS - 1,
+          static_cast<int>((centroids[id](axis) - lo) * bin_scale));
+        return b < best_bin;
+      }) - indices.begin());
+  }else
+  {
+    // All centroids coincide (or the tree got too deep): split at the median
+    // of the widest axis
+    extent.maxCoeff(&axis);
+    mid = begin + count / 2;
+    std::nth_element(
+      indices.begin() + begin, indices.begin() + mid, indices.begin() + end,
+      [&](const int a, const int b)
+      {
+        return centroids[a](axis) < centroids[b](axis);
+      });
+  }
+
+  build_recursive(boxes, centroids, begin, mid, depth + 1);
+  const int right = build_recursive(boxes, centroids, mid, end, depth + 1);
+  nodes[node_id].offset = right;
+  nodes[node_id].count = 0;
+  return node_id;
+}
+
+int BVH::collapse(const int node_id)
+{
+  // Replace the interior child with the largest box by its two children
+  // until the node is full (or only leaves are left): larger boxes are hit
+  // more often, so pulling them up saves the most node visits
+  int children[WideNode::WIDTH] = {node_id + 1, nodes[node_id].offset};
+  int num_children = 2;
+  while(num_children < WideNode::WIDTH)
+  {
+    int best = -1;
+    double best_area = -1.0;
+    for(int c = 0; c < num_children; ++c)
+    {
+      const Node & child = nodes[children[c]];
+      if(child.count == 0 && child.box.surface_area() > best_area)
+      {
+        best = c;
+        best_area = child.box.surface_area();
+      }
+    }
+    if(best < 0) break;
+    const int opened = children[best];
+    children[best] = opened + 1;
+    children[num_children++] = nodes[opened].offset;
+  }
+
+  const int wide_id = static_cast<int>(wide_nodes.size());
+  wide_nodes.emplace_back();
+  int child_ids[WideNode::WIDTH];
+  int leaf_mask = 0;
+  for(int c = 0; c < num_children; ++c)
+  {
+    if(nodes[children[c]].count > 0)
+    {
+      child_ids[c] = children[c];
+      leaf_mask |= 1 << c;
+    }else
+    {
+      // May reallocate wide_nodes
+      child_ids[c] = collapse(children[c]);
+    }
+  }
+
+  WideNode & wide = wide_nodes[wide_id];
+  for(int c = 0; c < WideNode::WIDTH; ++c)
+  {
+    // Unused lanes are masked out by num_children
+    const AABB box = c < num_children ? nodes[children[c]].box : AABB();
+    for(int a = 0; a < 3; ++a)
+    {
+      wide.min_corner[a][c] = box.min_corner(a);
+      wide.max_corner[a][c] = box.max_corner(a);
+    }
+    wide.child[c] = c < num_children ? child_ids[c] : -1;
+  }
+  wide.leaf_mask = leaf_mask;
+  wide.num_children = num_children;
+  return wide_id;
+}
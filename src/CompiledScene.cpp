@@ -0,0 +1,328 @@
+#include "CompiledScene.h"
+#include "Sphere.h"
+#include "Plane.h"
+#include "Triangle.h"
+#include "ray_intersect_sphere.h"
+#include "ray_intersect_plane.h"
+#include "ray_intersect_triangle.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Store object k in the array of its type
+static CompiledScene::Primitive compile_object(
+  const std::vector<std::shared_ptr<Object> > & objects,
+  const int k,
+  CompiledScene & scene)
+{
+  CompiledScene::Primitive prim;
+  prim.object_id = k;
+  const Object * object = objects[k].get();
+  if (const ::Sphere * sphere = dynamic_cast<const ::Sphere *>(object)) {
+    prim.type = CompiledScene::SPHERE;
+    prim.index = static_cast<int>(scene.spheres.size());
+    scene.spheres.push_back({sphere->center, sphere->radius});
+  } else if (const ::Plane * plane = dynamic_cast<const ::Plane *>(object)) {
+    prim.type = CompiledScene::PLANE;
+    prim.index = static_cast<int>(scene.planes.size());
+    scene.planes.push_back(
+      {plane->point, plane->normal, plane->normal.normalized()});
+  } else if (
+    const ::Triangle * tri = dynamic_cast<const ::Triangle *>(object)) {
+    const Eigen::Vector3d & v0 = std::get<0>(tri->corners);
+    const Eigen::Vector3d & v1 = std::get<1>(tri->corners);
+    const Eigen::Vector3d & v2 = std::get<2>(tri->corners);
+    prim.type = CompiledScene::TRIANGLE;
+    prim.index = static_cast<int>(scene.triangles.size());
+    scene.triangles.push_back(
+      {v0, v1 - v0, v2 - v0, triangle_normal(v0, v1, v2)});
+  } else {
+    prim.type = CompiledScene::OTHER;
+    prim.index = static_cast<int>(scene.others.size());
+    scene.others.push_back(object);
+  }
+  return prim;
+}
+
+void CompiledScene::build(
+  const std::vector<std::shared_ptr<Object> > & objects,
+  const bool use_bvh,
+  const bool single_precision)
+{
+  bvh = BVH();
+  primitives.clear();
+  unbounded.clear();
+  spheres.clear();
+  planes.clear();
+  triangles.clear();
+  others.clear();
+  copies.clear();
+  // In single precision, objects with hierarchies of their own are compiled
+  // from copies
+  std::vector<std::shared_ptr<Object> > single_objects;
+  if (single_precision) {
+    single_objects.reserve(objects.size());
+    for (const auto & object : objects) {
+      single_objects.push_back(single_precision_object(object, copies));
+    }
+  }
+  const std::vector<std::shared_ptr<Object> > & compiled =
+    single_precision ? single_objects : objects;
+
+  if (!use_bvh) {
+    for (int k = 0; k < static_cast<int>(compiled.size()); ++k) {
+      unbounded.push_back(compile_object(compiled, k, *this));
+    }
+    return;
+  }
+
+  bvh.set_single_precision(single_precision);
+  bvh.build(compiled);
+  for (const int k : bvh.unbounded) {
+    unbounded.push_back(compile_object(compiled, k, *this));
+  }
+  // Leaf order, so neighbouring leaves read neighbouring memory
+  primitives.reserve(bvh.indices.size());
+  for (const int k : bvh.indices) {
+    primitives.push_back(compile_object(compiled, k, *this));
+  }
+  // Group each leaf by type so the dispatch below is predictable (the order
+  // within a leaf does not matter: ties are broken by object id)
+  for (const BVH::Node & node : bvh.nodes) {
+    if (node.count == 0) continue;
+    std::sort(
+      primitives.begin() + node.offset,
+      primitives.begin() + node.offset + node.count,
+      [](const Primitive & a, const Primitive & b) {
+        return a.type < b.type ||
+          (a.type == b.type && a.object_id < b.object_id);
+      });
+  }
+}
+
+// Closest hit of one ray found so far (its distance is kept apart so that
+// packets can hand the distances of all rays to the traversal as one list)
+struct Closest
+{
+  const CompiledScene::Primitive * prim = nullptr;
+  // Hit reported by the object if prim is an OTHER primitive
+  Hit hit;
+};
+
+// Intersect one primitive, keeping the hit if it beats best_t
+static inline void visit(
+  const CompiledScene & scene,
+  const CompiledScene::Primitive & prim,
+  const Ray & ray,
+  const double min_t,
+  double & best_t,
+  Closest & best)
+{
+  const double inf = std::numeric_limits<double>::infinity();
+  double tk;
+  // Hits at exactly best_t still matter for the tie-break
+  const double max_t = std::nextafter(best_t, inf);
+  switch (prim.type) {
+    case CompiledScene::SPHERE: {
+      const CompiledScene::Sphere & s = scene.spheres[prim.index];
+      if (!ray_intersect_sphere(ray, s.center, s.radius, min_t, max_t, tk)) {
+        return;
+      }
+      break;
+    }
+    case CompiledScene::PLANE: {
+      const CompiledScene::Plane & p = scene.planes[prim.index];
+      if (!ray_intersect_plane(ray, p.point, p.normal, min_t, max_t, tk)) {
+        return;
+      }
+      break;
+    }
+    case CompiledScene::TRIANGLE: {
+      const CompiledScene::Triangle & tri = scene.triangles[prim.index];
+      if (!ray_intersect_triangle_edges(
+            ray, tri.v0, tri.e1, tri.e2, min_t, max_t, tk)) {
+        return;
+      }
+      break;
+    }
+    default: {
+      Hit hit;
+      if (!scene.others[prim.index]->intersect_hit(ray, min_t, max_t, hit)) {
+        return;
+      }
+      if (hit.t < best_t ||
+          (best.prim && hit.t == best_t && prim.object_id < best.prim->object_id)) {
+        best_t = hit.t;
+        best.prim = &prim;
+        best.hit = hit;
+      }
+      return;
+    }
+  }
+  // Primitives are visited out of order, so break ties like the linear scan
+  if (tk < best_t ||
+      (best.prim && tk == best_t && prim.object_id < best.prim->object_id)) {
+    best_t = tk;
+    best.prim = &prim;
+  }
+}
+
+// Report the closest hit of a ray (see CompiledScene::first_hit), computing
+// its normal
+static bool resolve(
+  const CompiledScene & scene,
+  const Ray & ray,
+  const double best_t,
+  const Closest & best,
+  int & hit_id,
+  int & hit_part,
+  double & t,
+  Eigen::Vector3d & n)
+{
+  if (!best.prim) return false;
+  t = best_t;
+  hit_id = best.prim->object_id;
+  hit_part = 0;
+  // Normal of the closest hit only
+  switch (best.prim->type) {
+    case CompiledScene::SPHERE:
+      n = sphere_normal(
+        scene.spheres[best.prim->index].center, ray.origin + t * ray.direction);
+      break;
+    case CompiledScene::PLANE:
+      n = scene.planes[best.prim->index].unit_normal;
+      break;
+    case CompiledScene::TRIANGLE:
+      n = scene.triangles[best.prim->index].normal;
+      break;
+    default:
+      n = scene.others[best.prim->index]->surface_normal(ray, best.hit);
+      hit_part = best.hit.part;
+      break;
+  }
+  return true;
+}
+
+bool CompiledScene::first_hit(
+  const Ray & ray,
+  const double min_t,
+  int & hit_id,
+  int & hit_part,
+  double & t,
+  Eigen::Vector3d & n) const
+{
+  double best_t = std::numeric_limits<double>::infinity();
+  Closest best;
+  for (const Primitive & prim : unbounded) {
+    visit(*this, prim, ray, min_t, best_t, best);
+  }
+  bvh.traverse_leaves(ray, min_t, best_t, [&](const int node_id) {
+    const BVH::Node & node = bvh.nodes[node_id];
+    for (int k = node.offset; k < node.offset + node.count; ++k) {
+      visit(*this, primitives[k], ray, min_t, best_t, best);
+    }
+    return false;
+  });
+  return resolve(*this, ray, best_t, best, hit_id, hit_part, t, n);
+}
+
+std::uint64_t CompiledScene::first_hit_packet(
+  const RayPacket & packet,
+  const double min_t,
+  int * hit_id,
+  int * hit_part,
+  double * t,
+  Eigen::Vector3d * n) const
+{
+  std::uint64_t hits = 0;
+  Ray rays[RayPacket::SIZE];
+  for (int l = 0; l < packet.count; ++l) rays[l] = packet.ray(l);
+
+  // Rays heading into different octants would order and cull nodes
+  // differently: trace them one at a time
+  if (!packet.coherent()) {
+    for (int l = 0; l < packet.count; ++l) {
+      if (first_hit(rays[l], min_t, hit_id[l], hit_part[l], t[l], n[l])) {
+        hits |= std::uint64_t(1) << l;
+      }
+    }
+    return hits;
+  }
+
+  alignas(32) double best_t[RayPacket::SIZE];
+  Closest best[RayPacket::SIZE];
+  for (int l = 0; l < RayPacket::SIZE; ++l) {
+    best_t[l] = std::numeric_limits<double>::infinity();
+  }
+  for (const Primitive & prim : unbounded) {
+    for (int l = 0; l < packet.count; ++l) {
+      visit(*this, prim, rays[l], min_t, best_t[l], best[l]);
+    }
+  }
+  bvh.traverse_leaves_packet(
+    packet, min_t, best_t, packet.lanes(),
+    [&](const int node_id, const std::uint64_t mask) {
+      const BVH::Node & node = bvh.nodes[node_id];
+      // Each primitive is fetched once for all the rays that reach it
+      for (int k = node.offset; k < node.offset + node.count; ++k) {
+        std::uint64_t bits = mask;
+        for (int l = 0; bits; ++l, bits >>= 1) {
+          if (bits & 1) {
+            visit(*this, primitives[k], rays[l], min_t, best_t[l], best[l]);
+          }
+        }
+      }
+    });
+
+  for (int l = 0; l < packet.count; ++l) {
+    if (resolve(
+          *this, rays[l], best_t[l], best[l],
+          hit_id[l], hit_part[l], t[l], n[l])) {
+      hits |= std::uint64_t(1) << l;
+    }
+  }
+  return hits;
+}
+
+bool CompiledScene::occluded(
+  const Ray & ray,
+  const double min_t,
+  const double max_t) const
+{
+  auto blocks = [&](const Primitive & prim) {
+    double tk;
+    switch (prim.type) {
+      case SPHERE: {
+        const Sphere & s = spheres[prim.index];
+        return ray_intersect_sphere(ray, s.center, s.radius, min_t, max_t, tk);
+      }
+      case PLANE: {
+        const Plane & p = planes[prim.index];
+        return ray_intersect_plane(ray, p.point, p.normal, min_t, max_t, tk);
+      }
+      case TRIANGLE: {
+        const Triangle & tri = triangles[prim.index];
+        return ray_intersect_triangle_edges(
+          ray, tri.v0, tri.e1, tri.e2, min_t, max_t, tk);
+      }
+      default:
+        return others[prim.index]->occluded(ray, min_t, max_t);
+    }
+  };
+
+  for (const Primitive & prim : unbounded) {
+    if (blocks(prim)) return true;
+  }
+  bool blocked = false;
+  bvh.traverse_leaves(ray, min_t, max_t, [&](const int node_id) {
+    const BVH::Node & node = bvh.nodes[node_id];
+    for (int k = node.offset; k < node.offset + node.count; ++k) {
+      if (blocks(primitives[k])) {
+        blocked = true;
+        return true;
+      }
+    }
+    return false;
+  });
+  return blocked;
+}
@@ -0,0 +1,122 @@
+#include "Group.h"
+#include "Ray.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+void Group::build()
+{
+  part_offsets.assign(1, 0);
+  for (const auto & object : objects) {
+    part_offsets.push_back(part_offsets.back() + object->num_parts());
+  }
+  bvh.build(objects);
+}
+
+int Group::child_of_part(const int part) const
+{
+  return static_cast<int>(
+    std::upper_bound(part_offsets.begin(), part_offsets.end(), part) -
+    part_offsets.begin()) - 1;
+}
+
+bool Group::intersect(
+  const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
+{
+  Hit hit;
+  if (!intersect_hit(
+        ray, min_t, std::numeric_limits<double>::infinity(), hit)) {
+    return false;
+  }
+  t = hit.t;
+  n = surface_normal(ray, hit);
+  return true;
+}
+
+bool Group::intersect_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  Hit & hit) const
+{
+  const double inf = std::numeric_limits<double>::infinity();
+  double best_t = max_t;
+  Hit best_hit;
+  int best_k = -1;
+  // Ties go to the first child in the list, whatever the visiting order (and
+  // never reach max_t itself: best_k < 0 until something beats it)
+  auto visit = [&](const int k) {
+    Hit hk;
+    if (objects[k]->intersect_hit(
+          ray, min_t, std::nextafter(best_t, inf), hk)) {
+      if (hk.t < best_t || (hk.t == best_t && k < best_k)) {
+        best_t = hk.t;
+        best_hit = hk;
+        best_k = k;
+      }
+    }
+    return false;
+  };
+  if (bvh.empty()) {
+    for (int k = 0; k < static_cast<int>(objects.size()); ++k) visit(k);
+  } else {
+    bvh.traverse(ray, min_t, best_t, visit);
+  }
+
+  if (best_k < 0) return false;
+  hit = best_hit;
+  hit.part += part_offsets[best_k];
+  return true;
+}
+
+Eigen::Vector3d Group::surface_normal(const Ray & ray, const Hit & hit) const
+{
+  const int k = child_of_part(hit.part);
+  Hit child_hit = hit;
+  child_hit.part -= part_offsets[k];
+  return objects[k]->surface_normal(ray, child_hit);
+}
+
+const Material & Group::part_material(const int part) const
+{
+  const int k = child_of_part(part);
+  return objects[k]->part_material(part - part_offsets[k]);
+}
+
+bool Group::occluded(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  bool blocked = false;
+  auto visit = [&](const int k) {
+    blocked = objects[k]->occluded(ray, min_t, max_t);
+    return blocked;
+  };
+  if (bvh.empty()) {
+    for (int k = 0; k < static_cast<int>(objects.size()) && !visit(k); ++k) {}
+  } else {
+    bvh.traverse(ray, min_t, max_t, visit);
+  }
+  return blocked;
+}
+
+bool Group::bounding_box(AABB & box) const
+{
+  box = AABB();
+  for (const auto & object : objects) {
+    AABB object_box;
+    if (!object->bounding_box(object_box)) return false;
+    box.insert(object_box);
+  }
+  return !box.empty();
+}
+
+std::shared_ptr<Object> Group::single_precision_copy(
+  SinglePrecisionCopies & copies) const
+{
+  std::shared_ptr<Group> copy(new Group(*this));
+  for (auto & object : copy->objects) {
+    object = single_precision_object(object, copies);
+  }
+  copy->bvh.set_single_precision(true);
+  return copy;
+}
@@ -0,0 +1,90 @@
+#include "Instance.h"
+#include "Ray.h"
+#include <limits>
+
+Instance::Instance(
+  const std::shared_ptr<Object> & object,
+  const Eigen::Affine3d & transform)
+  : object(object),
+    to_world(transform),
+    to_object(transform.inverse()),
+    normal_matrix(transform.linear().inverse().transpose()),
+    identity(transform.matrix().isIdentity(0.0))
+{
+}
+
+Ray Instance::object_ray(const Ray & ray) const
+{
+  if (identity) return ray;
+  Ray local;
+  local.origin = to_object * ray.origin;
+  local.direction = to_object.linear() * ray.direction;
+  return local;
+}
+
+bool Instance::intersect(
+  const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
+{
+  Hit hit;
+  if (!intersect_hit(
+        ray, min_t, std::numeric_limits<double>::infinity(), hit)) {
+    return false;
+  }
+  t = hit.t;
+  n = surface_normal(ray, hit);
+  return true;
+}
+
+bool Instance::intersect_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  Hit & hit) const
+{
+  return object->intersect_hit(object_ray(ray), min_t, max_t, hit);
+}
+
+Eigen::Vector3d Instance::surface_normal(
+  const Ray & ray, const Hit & hit) const
+{
+  const Eigen::Vector3d n = object->surface_normal(object_ray(ray), hit);
+  if (identity) return n;
+  return (normal_matrix * n).normalized();
+}
+
+const Material & Instance::part_material(const int part) const
+{
+  if (material) return *material;
+  return object->part_material(part);
+}
+
+bool Instance::occluded(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  return object->occluded(object_ray(ray), min_t, max_t);
+}
+
+bool Instance::bounding_box(AABB & box) const
+{
+  AABB object_box;
+  if (!object->bounding_box(object_box)) return false;
+  box = AABB();
+  for (int c = 0; c < 8; ++c) {
+    const Eigen::Vector3d corner(
+      (c & 1) ? object_box.max_corner(0) : object_box.min_corner(0),
+      (c & 2) ? object_box.max_corner(1) : object_box.min_corner(1),
+      (c & 4) ? object_box.max_corner(2) : object_box.min_corner(2));
+    box.insert(to_world * corner);
+  }
+  return true;
+}
+
+std::shared_ptr<Object> Instance::single_precision_copy(
+  SinglePrecisionCopies & copies) const
+{
+  const std::shared_ptr<Object> single = single_precision_object(object, copies);
+  if (single == object) return nullptr;
+  std::shared_ptr<Instance> copy(new Instance(*this));
+  copy->object = single;
+  return copy;
+}
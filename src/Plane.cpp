@@ -1,30 +1,43 @@
 #include "Plane.h"
 #include "Ray.h"
-#include <iostream>
+#include "ray_intersect_plane.h"
+#include <limits>
+
 bool Plane::intersect(
   const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
-{// Equation: (p - point) · normal = 0
-  // Ray: r(t) = ray.origin + t * ray.direction
-
-  const double denom = normal.dot(ray.direction);
-  const double eps = 1e-9;
-
-  // If denom ~ 0, ray is parallel to the plane = no intersection
-  if (std::abs(denom) < eps) {
+{
+  if (!ray_intersect_plane(
+        ray, point, normal, min_t, std::numeric_limits<double>::infinity(), t)) {
     return false;
   }
+  n = normal.normalized();
+  return true;
+}
 
-  const double tt = normal.dot(point - ray.origin) / denom;
-
-  // Only accept intersections in front of ray origin, and beyond min_t
-  if (tt < min_t + eps) {
+bool Plane::intersect_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  Hit & hit) const
+{
+  if (!ray_intersect_plane(ray, point, normal, min_t, max_t, hit.t)) {
     return false;
   }
-
-  t = tt;
-  n = normal.normalized();
+  hit.part = 0;
+  hit.primitive = 0;
   return true;
 }
 
+Eigen::Vector3d Plane::surface_normal(const Ray & ray, const Hit & hit) const
+{
+  (void) ray;
+  (void) hit;
+  return normal.normalized();
+}
 
-
+bool Plane::occluded(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  double t;
+  return ray_intersect_plane(ray, point, normal, min_t, max_t, t);
+}
@@ -0,0 +1,231 @@
+#include "ProgressiveRenderer.h"
+#include "Sampler.h"
+#include "camera_ray.h"
+#include "RayPacket.h"
+#include "raycolor.h"
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+ProgressiveRenderer::ProgressiveRenderer(
+  const std::vector< std::shared_ptr<Object> > & objects,
+  const CompiledScene & scene,
+  const std::vector< std::shared_ptr<Light> > & lights,
+  const int num_threads)
+  : objects(objects),
+    scene(scene),
+    lights(lights),
+    pool(num_threads)
+{
+  thread = std::thread(&ProgressiveRenderer::run, this);
+}
+
+ProgressiveRenderer::~ProgressiveRenderer()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    ++frame;
+  }
+  wake.notify_all();
+  thread.join();
+}
+
+void ProgressiveRenderer::restart(
+  const Camera & new_camera,
+  const RenderSettings & new_settings)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    camera = new_camera;
+    settings = new_settings;
+    ++frame;
+    traced_samples = render_samples_per_pixel(camera, settings);
+    next_pass = 0;
+    passes_done = 0;
+    sum.assign(3 * settings.width * settings.height, 0.0f);
+    count.assign(settings.width * settings.height, 0);
+    first_depth.assign(
+      settings.width * settings.height, std::numeric_limits<float>::infinity());
+    ++version;
+  }
+  wake.notify_all();
+}
+
+void ProgressiveRenderer::set_samples_per_pixel(const int samples_per_pixel)
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    settings.samples_per_pixel = samples_per_pixel;
+    traced_samples = render_samples_per_pixel(camera, settings);
+    ++version;
+  }
+  wake.notify_all();
+}
+
+double ProgressiveRenderer::pass_seconds()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return last_pass_seconds;
+}
+
+void ProgressiveRenderer::cancel()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  // Tiles of the pass in flight stop; a later set_samples_per_pixel goes on
+  // with the next pass, so no pixel gets a sample twice
+  ++frame;
+  traced_samples = next_pass;
+  ++version;
+}
+
+bool ProgressiveRenderer::snapshot(
+  std::vector<float> & radiance,
+  std::vector<float> & depth,
+  int & width,
+  int & height,
+  int & samples,
+  bool & done)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  if (version == version_seen) return false;
+  version_seen = version;
+  width = settings.width;
+  height = settings.height;
+  samples = passes_done;
+  done = !tracing && next_pass >= traced_samples;
+  if (radiance.size() != sum.size()) radiance.assign(sum.size(), 0.0f);
+  for (size_t p = 0; p < count.size(); ++p) {
+    if (count[p] == 0) continue;
+    const float scale = 1.0f / count[p];
+    for (int c = 0; c < 3; ++c) {
+      radiance[3 * p + c] = sum[3 * p + c] * scale;
+    }
+  }
+  depth = first_depth;
+  return true;
+}
+
+void ProgressiveRenderer::run()
+{
+  while (true) {
+    Camera pass_camera;
+    RenderSettings pass_settings;
+    int s;
+    unsigned pass_frame;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, [this]{ return stopping || next_pass < traced_samples; });
+      if (stopping) return;
+      pass_camera = camera;
+      pass_settings = settings;
+      s = next_pass++;
+      pass_frame = frame;
+      tracing = true;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    trace_pass(pass_camera, pass_settings, s, pass_frame);
+    const double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tracing = false;
+      if (frame == pass_frame) {
+        ++passes_done;
+        last_pass_seconds = seconds;
+      }
+      ++version;
+    }
+  }
+}
+
+void ProgressiveRenderer::trace_pass(
+  const Camera & camera,
+  const RenderSettings & settings,
+  const int s,
+  const unsigned pass_frame)
+{
+  const int width = settings.width;
+  const int height = settings.height;
+  // Blocks of at most RayPacket::SIZE pixels
+  const int packet_size = std::max(1, std::min(settings.packet_size, 8));
+
+  const int TILE_SIZE = 32;
+  const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+  const int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+  auto render_tile = [&](const int tile)
+  {
+    if (frame != pass_frame) return;
+    const int i0 = (tile / tiles_x) * TILE_SIZE;
+    const int j0 = (tile % tiles_x) * TILE_SIZE;
+    const int i1 = std::min(i0 + TILE_SIZE, height);
+    const int j1 = std::min(j0 + TILE_SIZE, width);
+    const int tile_width = j1 - j0;
+    std::vector<Eigen::Vector3d> rgb((i1 - i0) * tile_width);
+    std::vector<float> depth;
+    if (s == 0) {
+      depth.assign(rgb.size(), std::numeric_limits<float>::infinity());
+    }
+
+    // Sample s of a block of pixels as one packet (see render_image)
+    RayPacket packet;
+    int hit_id[RayPacket::SIZE], hit_part[RayPacket::SIZE];
+    double t[RayPacket::SIZE];
+    Eigen::Vector3d n[RayPacket::SIZE];
+    for (int bi = i0; bi < i1; bi += packet_size) {
+      if (frame != pass_frame) return;
+      for (int bj = j0; bj < j1; bj += packet_size) {
+        const int rows = std::min(packet_size, i1 - bi);
+        const int cols = std::min(packet_size, j1 - bj);
+        packet.count = rows * cols;
+        for (int l = 0; l < packet.count; ++l) {
+          const Sampler sampler(settings.seed, bi + l / cols, bj + l % cols, s);
+          Ray ray;
+          camera_ray(
+            camera, bi + l / cols, bj + l % cols, width, height,
+            settings.jitter, sampler, ray);
+          packet.set(l, ray);
+        }
+        const std::uint64_t hits =
+          scene.first_hit_packet(packet, 1.0, hit_id, hit_part, t, n);
+        for (int l = 0; l < packet.count; ++l) {
+          const int i = bi + l / cols;
+          const int j = bj + l % cols;
+          const Sampler sampler(settings.seed, i, j, s);
+          Eigen::Vector3d & sample_color = rgb[(i - i0) * tile_width + (j - j0)];
+          sample_color.setZero();
+          const bool hit = ((hits >> l) & 1) != 0;
+          if (s == 0 && hit) {
+            const Ray & ray = packet.ray(l);
+            depth[(i - i0) * tile_width + (j - j0)] = static_cast<float>(
+              (ray.origin + t[l] * ray.direction - camera.e).dot(-camera.w));
+          }
+          raycolor_from_hit(
+            packet.ray(l), hit,
+            hit_id[l], hit_part[l], t[l], n[l],
+            objects, scene, lights, settings.path, sampler, sample_color);
+        }
+      }
+    }
+
+    // Only tiles of the current frame may reach the sum
+    std::lock_guard<std::mutex> lock(mutex);
+    if (frame != pass_frame) return;
+    for (int i = i0; i < i1; ++i) {
+      for (int j = j0; j < j1; ++j) {
+        const Eigen::Vector3d & c = rgb[(i - i0) * tile_width + (j - j0)];
+        for (int k = 0; k < 3; ++k) {
+          sum[3 * (i * width + j) + k] += static_cast<float>(c(k));
+        }
+        ++count[i * width + j];
+        if (s == 0) {
+          first_depth[i * width + j] = depth[(i - i0) * tile_width + (j - j0)];
+        }
+      }
+    }
+    ++version;
+  };
+  pool.parallel_for(tiles_x * tiles_y, render_tile);
+}
@@ -1,42 +1,50 @@
 #include "Sphere.h"
 #include "Ray.h"
+#include "ray_intersect_sphere.h"
+#include <limits>
 
 bool Sphere::intersect(
   const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
 {
-  // Sphere equation: |(o + t d) - c|^2 = r^2
-  // Solve quadratic in t: (d·d)t^2 + 2oc·d t + (oc·oc - r^2) = 0
-
-  Eigen::Vector3d oc = ray.origin - center;
-  const Eigen::Vector3d & d = ray.direction;
-
-  double a = d.dot(d);                     // usually 1 if d is normalized
-  double b = 2.0 * oc.dot(d);
-  double c = oc.dot(oc) - radius * radius;
-
-  double discriminant = b * b - 4.0 * a * c;
-  if (discriminant < 0.0) {
-    return false; // no real roots = no intersection
+  if (!ray_intersect_sphere(
+        ray, center, radius, min_t, std::numeric_limits<double>::infinity(), t)) {
+    return false;
   }
+  n = sphere_normal(center, ray.origin + t * ray.direction);
+  return true;
+}
 
-  double sqrt_disc = std::sqrt(discriminant);
-  double t0 = (-b - sqrt_disc) / (2.0 * a);
-  double t1 = (-b + sqrt_disc) / (2.0 * a);
-
-  // Pick the closest valid t >= min_t
-  const double eps = 1e-9;
-  double tt = std::numeric_limits<double>::infinity();
-  if (t0 >= min_t + eps) {
-    tt = t0;
-  } else if (t1 >= min_t + eps) {
-    tt = t1;
-  } else {
-    return false; // both behind the ray or too close
+bool Sphere::intersect_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  Hit & hit) const
+{
+  if (!ray_intersect_sphere(ray, center, radius, min_t, max_t, hit.t)) {
+    return false;
   }
+  hit.part = 0;
+  hit.primitive = 0;
+  return true;
+}
+
+Eigen::Vector3d Sphere::surface_normal(const Ray & ray, const Hit & hit) const
+{
+  return sphere_normal(center, ray.origin + hit.t * ray.direction);
+}
 
-  t = tt;
-  Eigen::Vector3d p = ray.origin + t * d;
-  n = (p - center).normalized();
+bool Sphere::bounding_box(AABB & box) const
+{
+  box = AABB();
+  box.insert(center - Eigen::Vector3d::Constant(radius));
+  box.insert(center + Eigen::Vector3d::Constant(radius));
   return true;
 }
 
+bool Sphere::occluded(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  // Same roots as intersect, without the normal
+  double t;
+  return ray_intersect_sphere(ray, center, radius, min_t, max_t, t);
+}
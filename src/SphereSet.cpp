@@ -0,0 +1,185 @@
+#include "SphereSet.h"
+#include <cmath>
+#include <limits>
+
+void SphereSet::add(
+  const Eigen::Vector3d & center,
+  const double radius,
+  const std::shared_ptr<Material> & material)
+{
+  centers.push_back(center);
+  radii.push_back(radius);
+  materials.push_back(material);
+}
+
+void SphereSet::build_bvh()
+{
+  std::vector<AABB> boxes(num_spheres());
+  for (int s = 0; s < num_spheres(); ++s) {
+    boxes[s].insert(centers[s] - Eigen::Vector3d::Constant(radii[s]));
+    boxes[s].insert(centers[s] + Eigen::Vector3d::Constant(radii[s]));
+  }
+  bvh.build(boxes, SphereBlock::SIZE);
+
+  // Pack each leaf's spheres into blocks, allocated at their exact count
+  int num_blocks = 0;
+  for (const BVH::Node & node : bvh.nodes) {
+    num_blocks += (node.count + SphereBlock::SIZE - 1) / SphereBlock::SIZE;
+  }
+  std::vector<SphereBlock>().swap(blocks);
+  blocks.reserve(num_blocks);
+  leaf_blocks.assign(bvh.nodes.size(), -1);
+  for (int k = 0; k < static_cast<int>(bvh.nodes.size()); ++k) {
+    const BVH::Node & node = bvh.nodes[k];
+    if (node.count == 0) continue;
+    leaf_blocks[k] = static_cast<int>(blocks.size());
+    for (int i = 0; i < node.count; ++i) {
+      if (i % SphereBlock::SIZE == 0) blocks.emplace_back();
+      const int s = bvh.indices[node.offset + i];
+      blocks.back().set(i % SphereBlock::SIZE, s, centers[s], radii[s]);
+    }
+  }
+}
+
+// Test one sphere on its own (used before build_bvh) with the block kernel
+// in lane 0
+static bool intersect_one(
+  const SphereSet & set,
+  const int s,
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  double & t)
+{
+  SphereBlock block;
+  block.set(0, s, set.spheres().centers[s], set.spheres().radii[s]);
+  alignas(32) double tl[SphereBlock::SIZE];
+  if (!(ray_intersect_sphere_block(ray, block, min_t, max_t, tl) & 1)) {
+    return false;
+  }
+  t = tl[0];
+  return true;
+}
+
+bool SphereSet::intersect(
+  const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
+{
+  int part;
+  return intersect_part(ray, min_t, t, n, part);
+}
+
+bool SphereSet::intersect_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  Hit & hit) const
+{
+  const double inf = std::numeric_limits<double>::infinity();
+  const SphereSet & set = spheres();
+  double best_t = max_t;
+  int best_s = -1;
+  // Ties go to the first sphere in the list, whatever the visiting order
+  auto consider = [&](const int s, const double ts) {
+    if (ts < best_t || (ts == best_t && s < best_s)) {
+      best_t = ts;
+      best_s = s;
+    }
+  };
+  if (set.blocks.empty()) {
+    for (int s = 0; s < num_spheres(); ++s) {
+      double ts;
+      if (intersect_one(*this, s, ray, min_t, std::nextafter(best_t, inf), ts)) {
+        consider(s, ts);
+      }
+    }
+  } else {
+    bvh.traverse_leaves(ray, min_t, best_t, [&](const int node_id) {
+      const int num_blocks =
+        (bvh.nodes[node_id].count + SphereBlock::SIZE - 1) /
+        SphereBlock::SIZE;
+      const int first = set.leaf_blocks[node_id];
+      for (int b = first; b < first + num_blocks; ++b) {
+        alignas(32) double tl[SphereBlock::SIZE];
+        // Hits at exactly best_t still matter for the tie-break (and never
+        // reach max_t itself: best_s < 0 until something beats it)
+        int hits = ray_intersect_sphere_block(
+          ray, set.blocks[b], min_t, std::nextafter(best_t, inf), tl);
+        for (int l = 0; hits; ++l, hits >>= 1) {
+          if (hits & 1) consider(set.blocks[b].sphere[l], tl[l]);
+        }
+      }
+      return false;
+    });
+  }
+
+  if (best_s < 0) return false;
+  hit.t = best_t;
+  hit.part = best_s;
+  hit.primitive = best_s;
+  return true;
+}
+
+Eigen::Vector3d SphereSet::surface_normal(
+  const Ray & ray, const Hit & hit) const
+{
+  const Eigen::Vector3d p = ray.origin + hit.t * ray.direction;
+  return (p - spheres().centers[hit.primitive]).normalized();
+}
+
+const Material & SphereSet::part_material(const int part) const
+{
+  return *spheres().materials[part];
+}
+
+bool SphereSet::occluded(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  const SphereSet & set = spheres();
+  bool blocked = false;
+  if (set.blocks.empty()) {
+    for (int s = 0; s < num_spheres() && !blocked; ++s) {
+      double ts;
+      blocked = intersect_one(*this, s, ray, min_t, max_t, ts);
+    }
+    return blocked;
+  }
+  bvh.traverse_leaves(ray, min_t, max_t, [&](const int node_id) {
+    const int num_blocks =
+      (bvh.nodes[node_id].count + SphereBlock::SIZE - 1) /
+      SphereBlock::SIZE;
+    const int first = set.leaf_blocks[node_id];
+    for (int b = first; b < first + num_blocks; ++b) {
+      alignas(32) double tl[SphereBlock::SIZE];
+      if (ray_intersect_sphere_block(ray, set.blocks[b], min_t, max_t, tl)) {
+        blocked = true;
+        return true;
+      }
+    }
+    return false;
+  });
+  return blocked;
+}
+
+bool SphereSet::bounding_box(AABB & box) const
+{
+  const SphereSet & set = spheres();
+  box = AABB();
+  for (int s = 0; s < num_spheres(); ++s) {
+    box.insert(set.centers[s] - Eigen::Vector3d::Constant(set.radii[s]));
+    box.insert(set.centers[s] + Eigen::Vector3d::Constant(set.radii[s]));
+  }
+  return !box.empty();
+}
+
+std::shared_ptr<Object> SphereSet::single_precision_copy(
+  SinglePrecisionCopies & copies) const
+{
+  (void) copies;
+  if (bvh.empty()) return nullptr;
+  std::shared_ptr<SphereSet> copy(new SphereSet());
+  copy->material = material;
+  copy->source = this;
+  copy->bvh = bvh;
+  copy->bvh.set_single_precision(true);
+  return copy;
+}
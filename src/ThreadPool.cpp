@@ -0,0 +1,120 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int num_threads)
+{
+  if(num_threads <= 0)
+  {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for(int k = 0; k < num_threads; ++k)
+  {
+    queues.emplace_back(new Queue());
+  }
+  // Thread 0 is whoever calls parallel_for
+  for(int k = 1; k < num_threads; ++k)
+  {
+    threads.emplace_back(&ThreadPool::worker_loop, this, k);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  start_cv.notify_all();
+  for(auto & thread : threads)
+  {
+    thread.join();
+  }
+}
+
+void ThreadPool::parallel_for(
+  const int num_tasks,
+  const std::function<void(const int)> & task)
+{
+  if(num_tasks <= 0) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    current_task = &task;
+    pending = num_tasks;
+    // Deal out contiguous blocks so neighbouring tiles share caches
+    const int n = size();
+    for(int t = 0; t < n; ++t)
+    {
+      std::lock_guard<std::mutex> queue_lock(queues[t]->mutex);
+      for(int k = (num_tasks * t) / n; k < (num_tasks * (t + 1)) / n; ++k)
+      {
+        queues[t]->tasks.push_back(k);
+      }
+    }
+    ++generation;
+  }
+  start_cv.notify_all();
+
+  work(0);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cv.wait(lock, [this]{ return pending == 0; });
+  current_task = nullptr;
+}
+
+bool ThreadPool::next_task(const int thread_id, int & task_id)
+{
+  const int n = size();
+  {
+    Queue & own = *queues[thread_id];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if(!own.tasks.empty())
+    {
+      task_id = own.tasks.front();
+      own.tasks.pop_front();
+      return true;
+    }
+  }
+  for(int k = 1; k < n; ++k)
+  {
+    Queue & victim = *queues[(thread_id + k) % n];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if(!victim.tasks.empty())
+    {
+      task_id = victim.tasks.back();
+      victim.tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::work(const int thread_id)
+{
+  int task_id;
+  while(next_task(thread_id, task_id))
+  {
+    // Tasks are only queued while current_task is set, and it is not reset
+    // before every queued task has finished.
+    (*current_task)(task_id);
+    if(--pending == 0)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done_cv.notify_all();
+    }
+  }
+}
+
+void ThreadPool::worker_loop(const int thread_id)
+{
+  unsigned long long seen = 0;
+  while(true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      start_cv.wait(lock, [&]{ return stopping || generation != seen; });
+      if(stopping) return;
+      seen = generation;
+    }
+    work(thread_id);
+  }
+}
@@ -1,8 +1,7 @@
 #include "Triangle.h"
 #include "Ray.h"
-#include <Eigen/Geometry>
-#include <Eigen/Dense>
-#include <iostream>
+#include "ray_intersect_triangle.h"
+#include <limits>
 
 bool Triangle::intersect(
   const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
@@ -10,32 +9,55 @@ bool Triangle::intersect(
   const Eigen::Vector3d & v0 = std::get<0>(corners);
   const Eigen::Vector3d & v1 = std::get<1>(corners);
   const Eigen::Vector3d & v2 = std::get<2>(corners);
+  if (!ray_intersect_triangle(
+        ray, v0, v1, v2, min_t, std::numeric_limits<double>::infinity(), t)) {
+    return false;
+  }
+  n = triangle_normal(v0, v1, v2);
+  return true;
+}
 
-  const Eigen::Vector3d e1 = v1 - v0;
-  const Eigen::Vector3d e2 = v2 - v0;
-
-  const Eigen::Vector3d pvec = ray.direction.cross(e2);
-  const double det = e1.dot(pvec);
-
-  const double eps = 1e-9;
-  if (std::abs(det) < eps) return false; // ray parallel to triangle
-
-  const double invDet = 1.0 / det;
-
-  const Eigen::Vector3d tvec = ray.origin - v0;
-  const double u = tvec.dot(pvec) * invDet;
-  if (u < 0.0 || u > 1.0) return false;
+bool Triangle::intersect_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  Hit & hit) const
+{
+  if (!ray_intersect_triangle(
+        ray,
+        std::get<0>(corners), std::get<1>(corners), std::get<2>(corners),
+        min_t, max_t, hit.t)) {
+    return false;
+  }
+  hit.part = 0;
+  hit.primitive = 0;
+  return true;
+}
 
-  const Eigen::Vector3d qvec = tvec.cross(e1);
-  const double v = ray.direction.dot(qvec) * invDet;
-  if (v < 0.0 || u + v > 1.0) return false;
+Eigen::Vector3d Triangle::surface_normal(
+  const Ray & ray, const Hit & hit) const
+{
+  (void) ray;
+  (void) hit;
+  return triangle_normal(
+    std::get<0>(corners), std::get<1>(corners), std::get<2>(corners));
+}
 
-  const double tt = e2.dot(qvec) * invDet;
-  if (tt < min_t + eps) return false;
+bool Triangle::occluded(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  double t;
+  return ray_intersect_triangle(
+    ray,
+    std::get<0>(corners), std::get<1>(corners), std::get<2>(corners),
+    min_t, max_t, t);
+}
 
-  t = tt;
-  n = e1.cross(e2).normalized();
+bool Triangle::bounding_box(AABB & box) const
+{
+  box = AABB();
+  box.insert(std::get<0>(corners));
+  box.insert(std::get<1>(corners));
+  box.insert(std::get<2>(corners));
   return true;
 }
-
-
@@ -1,26 +1,254 @@
 #include "TriangleSoup.h"
-#include "Triangle.h"
-#include "first_hit.h"
+#include "ray_intersect_triangle.h"
+#include <cmath>
+#include <limits>
+
+void TriangleSoup::build_bvh()
+{
+  std::vector<AABB> boxes(num_faces());
+  for (int f = 0; f < num_faces(); ++f) {
+    for (int c = 0; c < 3; ++c) {
+      boxes[f].insert(corner(f, c));
+    }
+  }
+  const int block_size =
+    single ? FloatTriangleBlock::SIZE : TriangleBlock::SIZE;
+  bvh.set_single_precision(single);
+  bvh.build(boxes, block_size);
+
+  // Pack each leaf's faces into blocks (leaves hold at most one block of
+  // faces, so usually exactly one block), allocated at their exact count
+  int num_blocks = 0;
+  for (const BVH::Node & node : bvh.nodes) {
+    num_blocks += (node.count + block_size - 1) / block_size;
+  }
+  std::vector<TriangleBlock>().swap(blocks);
+  std::vector<FloatTriangleBlock>().swap(float_blocks);
+  if (single) {
+    float_blocks.reserve(num_blocks);
+  } else {
+    blocks.reserve(num_blocks);
+  }
+  leaf_blocks.assign(bvh.nodes.size(), -1);
+  for (int k = 0; k < static_cast<int>(bvh.nodes.size()); ++k) {
+    const BVH::Node & node = bvh.nodes[k];
+    if (node.count == 0) continue;
+    leaf_blocks[k] = static_cast<int>(
+      single ? float_blocks.size() : blocks.size());
+    for (int i = 0; i < node.count; ++i) {
+      const int f = bvh.indices[node.offset + i];
+      if (single) {
+        if (i % FloatTriangleBlock::SIZE == 0) float_blocks.emplace_back();
+        float_blocks.back().push(f, corner(f, 0), corner(f, 1), corner(f, 2));
+      } else {
+        if (i % TriangleBlock::SIZE == 0) blocks.emplace_back();
+        blocks.back().set(
+          i % TriangleBlock::SIZE, f, corner(f, 0), corner(f, 1), corner(f, 2));
+      }
+    }
+  }
+}
+
+std::shared_ptr<Object> TriangleSoup::single_precision_copy(
+  SinglePrecisionCopies & copies) const
+{
+  (void) copies;
+  if (single) return nullptr;
+  std::shared_ptr<TriangleSoup> copy(new TriangleSoup());
+  copy->material = material;
+  copy->source = this;
+  copy->single = true;
+  if (!bvh.empty()) copy->build_bvh();
+  return copy;
+}
+
+// Blocks of a leaf of a soup's BVH
+static int num_leaf_blocks(
+  const TriangleSoup & soup, const int node_id, const int block_size)
+{
+  return (soup.bvh.nodes[node_id].count + block_size - 1) / block_size;
+}
+
+// Decide the candidate lanes of a single precision block in double, packed
+// into TriangleBlocks so they go through the very kernel `blocks` use (and
+// hits are bit-identical). Calls hit(face, t) for every hit in
+// [min_t,max_t()), reading max_t() again for every group of candidates.
+//
+// Returns true as soon as hit does
+template <typename MaxFunc, typename HitFunc>
+static bool decide_candidates(
+  const TriangleSoup & soup,
+  const Ray & ray,
+  const FloatTriangleBlock & block,
+  int candidates,
+  const double min_t,
+  MaxFunc && max_t,
+  HitFunc && hit)
+{
+  for (int l = 0; candidates; ) {
+    TriangleBlock group;
+    int n = 0;
+    for (; candidates && n < TriangleBlock::SIZE; ++l, candidates >>= 1) {
+      if (!(candidates & 1)) continue;
+      const int f = block.face[l];
+      group.set(n++, f, soup.corner(f, 0), soup.corner(f, 1), soup.corner(f, 2));
+    }
+    alignas(32) double tl[TriangleBlock::SIZE];
+    int hits = ray_intersect_triangle_block(ray, group, min_t, max_t(), tl);
+    for (int k = 0; hits; ++k, hits >>= 1) {
+      if ((hits & 1) && hit(group.face[k], tl[k])) return true;
+    }
+  }
+  return false;
+}
+
 bool TriangleSoup::intersect(
   const Ray & ray, const double min_t, double & t, Eigen::Vector3d & n) const
 {
-  bool hit = false;
-  double best_t = std::numeric_limits<double>::infinity();
-  Eigen::Vector3d best_n(0,0,0);
-  for (const auto & tri : triangles) {
-    double tk;
-    Eigen::Vector3d nk;
-    if (tri->intersect(ray, min_t, tk, nk)) {
-      if (tk < best_t) {
-        best_t = tk;
-        best_n = nk;
-        hit = true;
+  Hit hit;
+  if (!intersect_hit(
+        ray, min_t, std::numeric_limits<double>::infinity(), hit)) {
+    return false;
+  }
+  t = hit.t;
+  n = surface_normal(ray, hit);
+  return true;
+}
+
+bool TriangleSoup::intersect_hit(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  Hit & hit) const
+{
+  const double inf = std::numeric_limits<double>::infinity();
+  double best_t = max_t;
+  int best_f = -1;
+  // Ties go to the first face in the list, whatever the visiting order
+  auto consider = [&](const int f, const double tf) {
+    if (tf < best_t || (tf == best_t && f < best_f)) {
+      best_t = tf;
+      best_f = f;
+    }
+  };
+  if (bvh.empty()) {
+    for (int f = 0; f < num_faces(); ++f) {
+      double tf;
+      if (ray_intersect_triangle(
+            ray, corner(f, 0), corner(f, 1), corner(f, 2),
+            min_t, std::nextafter(best_t, inf), tf)) {
+        consider(f, tf);
       }
     }
+  } else if (single) {
+    const FloatTriangleRay float_ray(ray);
+    bvh.traverse_leaves(ray, min_t, best_t, [&](const int node_id) {
+      const int first = leaf_blocks[node_id];
+      const int last =
+        first + num_leaf_blocks(*this, node_id, FloatTriangleBlock::SIZE);
+      for (int b = first; b < last; ++b) {
+        const FloatTriangleBlock & block = float_blocks[b];
+        decide_candidates(
+          *this, ray, block,
+          ray_triangle_block_candidates(
+            float_ray, block, min_t, std::nextafter(best_t, inf)),
+          min_t,
+          [&]() { return std::nextafter(best_t, inf); },
+          [&](const int f, const double tf) {
+            consider(f, tf);
+            return false;
+          });
+      }
+      return false;
+    });
+  } else {
+    bvh.traverse_leaves(ray, min_t, best_t, [&](const int node_id) {
+      const int num_blocks =
+        num_leaf_blocks(*this, node_id, TriangleBlock::SIZE);
+      for (int b = leaf_blocks[node_id]; b < leaf_blocks[node_id] + num_blocks; ++b) {
+        alignas(32) double tl[TriangleBlock::SIZE];
+        // Hits at exactly best_t still matter for the tie-break (and never
+        // reach max_t itself: best_f < 0 until something beats it)
+        int hits = ray_intersect_triangle_block(
+          ray, blocks[b], min_t, std::nextafter(best_t, inf), tl);
+        for (int l = 0; hits; ++l, hits >>= 1) {
+          if (hits & 1) consider(blocks[b].face[l], tl[l]);
+        }
+      }
+      return false;
+    });
   }
 
-  if (!hit) return false;
-  t = best_t;
-  n = best_n;
+  if (best_f < 0) return false;
+  hit.t = best_t;
+  hit.part = 0;
+  hit.primitive = best_f;
   return true;
 }
+
+Eigen::Vector3d TriangleSoup::surface_normal(
+  const Ray & ray, const Hit & hit) const
+{
+  (void) ray;
+  const int f = hit.primitive;
+  return triangle_normal(corner(f, 0), corner(f, 1), corner(f, 2));
+}
+
+bool TriangleSoup::occluded(
+  const Ray & ray, const double min_t, const double max_t) const
+{
+  bool blocked = false;
+  if (bvh.empty()) {
+    for (int f = 0; f < num_faces() && !blocked; ++f) {
+      double tf;
+      blocked = ray_intersect_triangle(
+        ray, corner(f, 0), corner(f, 1), corner(f, 2), min_t, max_t, tf);
+    }
+    return blocked;
+  }
+  if (single) {
+    const FloatTriangleRay float_ray(ray);
+    bvh.traverse_leaves(ray, min_t, max_t, [&](const int node_id) {
+      const int first = leaf_blocks[node_id];
+      const int last =
+        first + num_leaf_blocks(*this, node_id, FloatTriangleBlock::SIZE);
+      for (int b = first; b < last; ++b) {
+        const FloatTriangleBlock & block = float_blocks[b];
+        if (decide_candidates(
+              *this, ray, block,
+              ray_triangle_block_candidates(float_ray, block, min_t, max_t),
+              min_t,
+              [&]() { return max_t; },
+              [](const int, const double) { return true; })) {
+          blocked = true;
+          return true;
+        }
+      }
+      return false;
+    });
+    return blocked;
+  }
+  bvh.traverse_leaves(ray, min_t, max_t, [&](const int node_id) {
+    const int num_blocks = num_leaf_blocks(*this, node_id, TriangleBlock::SIZE);
+    for (int b = leaf_blocks[node_id]; b < leaf_blocks[node_id] + num_blocks; ++b) {
+      alignas(32) double tl[TriangleBlock::SIZE];
+      if (ray_intersect_triangle_block(ray, blocks[b], min_t, max_t, tl)) {
+        blocked = true;
+        return true;
+      }
+    }
+    return false;
+  });
+  return blocked;
+}
+
+bool TriangleSoup::bounding_box(AABB & box) const
+{
+  box = AABB();
+  for (int f = 0; f < num_faces(); ++f) {
+    for (int c = 0; c < 3; ++c) {
+      box.insert(corner(f, c));
+    }
+  }
+  return !box.empty();
+}
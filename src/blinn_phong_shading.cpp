@@ -1,6 +1,7 @@
 #include "blinn_phong_shading.h"
 // Hint:
-#include "first_hit.h"
+#include "occluded.h"
+#include "RayStats.h"
 #include <iostream>
 #include <algorithm>
 #include <cmath>
@@ -8,61 +9,105 @@
 Eigen::Vector3d blinn_phong_shading(
   const Ray & ray,
   const int & hit_id, 
+  const int & hit_part,
   const double & t,
   const Eigen::Vector3d & n,
   const std::vector< std::shared_ptr<Object> > & objects,
+  const CompiledScene & scene,
   const std::vector<std::shared_ptr<Light> > & lights)
 {
-  const double EPS = 1e-8;
+  // Access material (per part, e.g., each sphere of a SphereSet)
+  const Material &mat = objects[hit_id]->part_material(hit_part);
 
-  // 1) Intersection point p and view vector v (pointing from p toward camera)
+  // Ambient once
+  Eigen::Vector3d L = blinn_phong_ambient(mat);
   const Eigen::Vector3d p = ray.origin + t * ray.direction;
   const Eigen::Vector3d v = (-ray.direction).normalized();
 
-  // Access material (material is a shared_ptr in this starter)
-  const Material &mat = *objects[hit_id]->material;
+  // For each light: shadow test, then add diffuse + specular
+  for (const auto &light : lights)
+  {
+    Ray sray;
+    double min_t, max_t;
+    Eigen::Vector3d color;
+    if (!blinn_phong_light(p, v, n, mat, *light, sray, min_t, max_t, color)) {
+      continue;
+    }
+    // If anything blocks the shadow ray before reaching the light, skip
+    // this light
+    thread_ray_stats().shadow++;
+    if (scene.occluded(sray, min_t, max_t)) continue;
+
+    L += color;
+  }
 
-  // 2) Ambient once (ia = 0.1)
+  return L;
+}
+
+Eigen::Vector3d blinn_phong_ambient(const Material & mat)
+{
+  // ia = 0.1
   const double ia = 0.1;
-  Eigen::Vector3d L = ia * mat.ka;
+  return ia * mat.ka;
+}
 
-  // 3) For each light: shadow test, then add diffuse + specular
-  for (const auto &light : lights)
-  {
-    // Direction from p toward light, and how far to test (in parametric t)
-    Eigen::Vector3d toL;
-    double max_t;
-    light->direction(p, toL, max_t);
+bool blinn_phong_light(
+  const Ray & ray,
+  const double t,
+  const Eigen::Vector3d & n,
+  const Material & mat,
+  const Light & light,
+  Ray & shadow_ray,
+  double & min_t,
+  double & max_t,
+  Eigen::Vector3d & color)
+{
+  // 1) Intersection point p and view vector v (pointing from p toward camera)
+  const Eigen::Vector3d p = ray.origin + t * ray.direction;
+  const Eigen::Vector3d v = (-ray.direction).normalized();
+  return blinn_phong_light(p, v, n, mat, light, shadow_ray, min_t, max_t, color);
+}
 
-    // Shadow ray
-    Ray sray;
-    sray.origin    = p + EPS * n;    
-    sray.direction = toL.normalized();     // unit light direction
+bool blinn_phong_light(
+  const Eigen::Vector3d & p,
+  const Eigen::Vector3d & v,
+  const Eigen::Vector3d & n,
+  const Material & mat,
+  const Light & light,
+  Ray & shadow_ray,
+  double & min_t,
+  double & max_t,
+  Eigen::Vector3d & color)
+{
+  const double EPS = 1e-8;
 
-    // If something blocks before reaching the light, skip this light
-    int sid; double st; Eigen::Vector3d sn;
-    const bool occluded =
-      first_hit(sray, EPS, objects, sid, st, sn) && (st < max_t);
-    if (occluded) continue;
+  // 2) Direction from p toward light, and how far to test (in parametric t)
+  Eigen::Vector3d toL;
+  light.direction(p, toL, max_t);
+  const Eigen::Vector3d l = toL.normalized();     // unit light direction
 
-    // Light color/intensity
-    const Eigen::Vector3d I = light->I;
+  // Lights behind the surface contribute nothing: skip their shadow ray
+  const double ndotl = n.dot(l);
+  if (ndotl <= 0.0) return false;
 
-    // Diffuse: kd * I * max(0, n·l)
-    const double ndotl = std::max(0.0, n.dot(sray.direction));
-    if (ndotl > 0.0) {
-      const Eigen::Vector3d diffuse =
-        (mat.kd.array() * I.array()).matrix() * ndotl;
+  // 3) Shadow ray
+  shadow_ray.origin    = p + EPS * n;
+  shadow_ray.direction = l;
+  min_t = EPS;
 
-      // Specular (Blinn-Phong): ks * I * max(0, n·h)^p
-      const Eigen::Vector3d h = (sray.direction + v).normalized();
-      const double ndoth = std::max(0.0, n.dot(h));
-      const Eigen::Vector3d specular =
-        (mat.ks.array() * I.array()).matrix() * std::pow(ndoth, mat.phong_exponent);
+  // Light color/intensity
+  const Eigen::Vector3d I = light.I;
 
-      L += diffuse + specular;
-    }
-  }
+  // Diffuse: kd * I * max(0, n·l)
+  const Eigen::Vector3d diffuse =
+    (mat.kd.array() * I.array()).matrix() * ndotl;
 
-  return L;
+  // Specular (Blinn-Phong): ks * I * max(0, n·h)^p
+  const Eigen::Vector3d h = (l + v).normalized();
+  const double ndoth = std::max(0.0, n.dot(h));
+  const Eigen::Vector3d specular =
+    (mat.ks.array() * I.array()).matrix() * std::pow(ndoth, mat.phong_exponent);
+
+  color = diffuse + specular;
+  return true;
 }
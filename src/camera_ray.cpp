@@ -0,0 +1,34 @@
+#include "camera_ray.h"
+#include "viewing_ray_dof.h"
+
+void camera_ray(
+  const Camera & camera,
+  const int i,
+  const int j,
+  const int width,
+  const int height,
+  const bool jitter,
+  const Sampler & sampler,
+  Ray & ray)
+{
+  // Pixel center unless jittering
+  double px = 0.5, py = 0.5;
+  if (jitter) {
+    px = sampler.uniform(SAMPLE_PIXEL_X);
+    py = sampler.uniform(SAMPLE_PIXEL_Y);
+  }
+
+  // The lens sample is only drawn if the aperture is open
+  double u = 0.5, v = 0.5;
+  if (camera.aperture > 0.0) {
+    u = sampler.uniform(SAMPLE_LENS_U);
+    v = sampler.uniform(SAMPLE_LENS_V);
+  }
+
+  viewing_ray_dof(camera, i, j, width, height, px, py, u, v, ray);
+}
+
+bool camera_ray_is_random(const Camera & camera, const bool jitter)
+{
+  return jitter || camera.aperture > 0.0;
+}
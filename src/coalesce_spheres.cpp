@@ -0,0 +1,40 @@
+#include "coalesce_spheres.h"
+#include "Sphere.h"
+#include "SphereSet.h"
+#include <algorithm>
+
+int coalesce_spheres(
+  std::vector<std::shared_ptr<Object> > & objects,
+  const int min_run)
+{
+  std::vector<std::shared_ptr<Object> > result;
+  result.reserve(objects.size());
+  int moved = 0;
+  const int num_objects = static_cast<int>(objects.size());
+  for (int begin = 0; begin < num_objects; ) {
+    int end = begin;
+    while (end < num_objects &&
+      dynamic_cast<const Sphere *>(objects[end].get())) {
+      ++end;
+    }
+    if (end - begin < std::max(min_run, 1)) {
+      // Too short (or not spheres): keep as is
+      const int last = std::max(end, begin + 1);
+      result.insert(result.end(), objects.begin() + begin, objects.begin() + last);
+      begin = last;
+      continue;
+    }
+    std::shared_ptr<SphereSet> set(new SphereSet());
+    for (int k = begin; k < end; ++k) {
+      const Sphere & sphere = static_cast<const Sphere &>(*objects[k]);
+      set->add(sphere.center, sphere.radius, sphere.material);
+    }
+    set->material = objects[begin]->material;
+    set->build_bvh();
+    result.push_back(set);
+    moved += end - begin;
+    begin = end;
+  }
+  objects.swap(result);
+  return moved;
+}
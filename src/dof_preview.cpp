@@ -0,0 +1,123 @@
+#include "dof_preview.h"
+#include <algorithm>
+#include <cmath>
+
+double circle_of_confusion(
+  const Camera & camera,
+  const int width,
+  const double depth)
+{
+  if (camera.aperture <= 0.0 || !(depth > 0.0)) return 0.0;
+  // Misses (infinite depth) blur like points at infinity
+  const double image_radius =
+    camera.aperture * camera.d * std::abs(1.0 / camera.focal_distance - 1.0 / depth);
+  return image_radius * width / camera.width;
+}
+
+void dof_preview(
+  const Camera & camera,
+  const int width,
+  const int height,
+  const std::vector<float> & radiance,
+  const std::vector<float> & depth,
+  ThreadPool & pool,
+  std::vector<float> & blurred)
+{
+  // Blur radii are capped so a wide-open lens cannot make a pixel gather
+  // from the whole frame
+  const double MAX_RADIUS = 32.0;
+  // Most neighbours one pixel gathers (the spiral thins out beyond that)
+  const double MAX_TAPS = 128.0;
+  const double GOLDEN_ANGLE = 2.39996322972865332;
+  blurred.resize(3 * width * height);
+
+  std::vector<float> coc(width * height);
+  for (int p = 0; p < width * height; ++p) {
+    coc[p] = static_cast<float>(
+      std::min(circle_of_confusion(camera, width, depth[p]), MAX_RADIUS));
+  }
+
+  // Largest circle that can reach each 16x16 tile: the maximum over the
+  // tiles within MAX_RADIUS of it
+  const int TILE_SIZE = 16;
+  const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+  const int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+  std::vector<float> tile_max(tiles_x * tiles_y, 0.0f);
+  for (int i = 0; i < height; ++i) {
+    for (int j = 0; j < width; ++j) {
+      float & m = tile_max[(i / TILE_SIZE) * tiles_x + j / TILE_SIZE];
+      m = std::max(m, coc[i * width + j]);
+    }
+  }
+  const int reach = static_cast<int>(std::ceil(MAX_RADIUS / TILE_SIZE));
+  std::vector<float> tile_reach(tiles_x * tiles_y, 0.0f);
+  for (int ti = 0; ti < tiles_y; ++ti) {
+    for (int tj = 0; tj < tiles_x; ++tj) {
+      float m = 0.0f;
+      for (int ni = std::max(0, ti - reach); ni <= std::min(tiles_y - 1, ti + reach); ++ni) {
+        for (int nj = std::max(0, tj - reach); nj <= std::min(tiles_x - 1, tj + reach); ++nj) {
+          m = std::max(m, tile_max[ni * tiles_x + nj]);
+        }
+      }
+      tile_reach[ti * tiles_x + tj] = m;
+    }
+  }
+
+  // Spiral taps for every whole gather radius up to MAX_RADIUS: about `step`
+  // pixels apart, so the gathered disk is covered evenly by about MAX_TAPS
+  // of them (but at least one per pixel of radius near the center)
+  struct Tap
+  {
+    int di, dj;
+    float radius;
+  };
+  const int num_radii = static_cast<int>(MAX_RADIUS) + 1;
+  std::vector<std::vector<Tap> > spirals(num_radii);
+  for (int r = 1; r < num_radii; ++r) {
+    const double step = std::max(0.5, r * r / (2.0 * MAX_TAPS));
+    double angle = 0.0;
+    for (double radius = 1.0; radius < r; radius += std::min(1.0, step / radius)) {
+      angle += GOLDEN_ANGLE;
+      spirals[r].push_back({
+        static_cast<int>(std::lround(radius * std::sin(angle))),
+        static_cast<int>(std::lround(radius * std::cos(angle))),
+        static_cast<float>(radius)});
+    }
+  }
+
+  auto smoothstep = [](const float edge0, const float edge1, float x)
+  {
+    x = std::max(0.0f, std::min(1.0f, (x - edge0) / (edge1 - edge0)));
+    return x * x * (3.0f - 2.0f * x);
+  };
+
+  auto blur_row = [&](const int i)
+  {
+    for (int j = 0; j < width; ++j) {
+      const int p = i * width + j;
+      float color[3] = {radiance[3 * p], radiance[3 * p + 1], radiance[3 * p + 2]};
+      const int r = static_cast<int>(
+        std::ceil(tile_reach[(i / TILE_SIZE) * tiles_x + j / TILE_SIZE]));
+      float total = 1.0f;
+      for (const Tap & tap : spirals[r]) {
+        const int qi = std::min(height - 1, std::max(0, i + tap.di));
+        const int qj = std::min(width - 1, std::max(0, j + tap.dj));
+        const int q = qi * width + qj;
+        float q_radius = coc[q];
+        if (depth[q] > depth[p]) {
+          q_radius = std::min(q_radius, 2.0f * coc[p]);
+        }
+        // Blend toward the running mean where the neighbour does not reach
+        const float m = smoothstep(tap.radius - 0.5f, tap.radius + 0.5f, q_radius);
+        for (int c = 0; c < 3; ++c) {
+          color[c] += (1.0f - m) * color[c] / total + m * radiance[3 * q + c];
+        }
+        total += 1.0f;
+      }
+      for (int c = 0; c < 3; ++c) {
+        blurred[3 * p + c] = color[c] / total;
+      }
+    }
+  };
+  pool.parallel_for(height, blur_row);
+}
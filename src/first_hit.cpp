@@ -1,4 +1,6 @@
 #include "first_hit.h"
+#include <cmath>
+#include <limits>
 
 bool first_hit(
   const Ray & ray, 
@@ -32,3 +34,47 @@ bool first_hit(
   hit_id = best_id;
   return true;
 }
+
+bool first_hit(
+  const Ray & ray, 
+  const double min_t,
+  const std::vector< std::shared_ptr<Object> > & objects,
+  const BVH & bvh,
+  int & hit_id, 
+  int & hit_part,
+  double & t,
+  Eigen::Vector3d & n)
+{
+  const double inf = std::numeric_limits<double>::infinity();
+  double best_t = inf;
+  Hit best_hit;
+  int best_id = -1;
+
+  auto visit = [&](const int k) {
+    Hit hit;
+    // Objects are visited out of order, so hits at exactly best_t still
+    // matter: break ties like the linear scan
+    if (objects[k]->intersect_hit(
+          ray, min_t, std::nextafter(best_t, inf), hit)) {
+      if (hit.t < best_t || (hit.t == best_t && k < best_id)) {
+        best_t = hit.t;
+        best_hit = hit;
+        best_id = k;
+      }
+    }
+    return false;
+  };
+  if (bvh.empty()) {
+    for (int k = 0; k < static_cast<int>(objects.size()); ++k) visit(k);
+  } else {
+    bvh.traverse(ray, min_t, best_t, visit);
+  }
+
+  if (best_id < 0) return false;
+  t = best_t;
+  // Normal of the closest hit only
+  n = objects[best_id]->surface_normal(ray, best_hit);
+  hit_id = best_id;
+  hit_part = best_hit.part;
+  return true;
+}
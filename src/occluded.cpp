@@ -0,0 +1,23 @@
+#include "occluded.h"
+
+bool occluded(
+  const Ray & ray,
+  const double min_t,
+  const double max_t,
+  const std::vector< std::shared_ptr<Object> > & objects,
+  const BVH & bvh)
+{
+  if (bvh.empty()) {
+    for (const auto & object : objects) {
+      if (object->occluded(ray, min_t, max_t)) return true;
+    }
+    return false;
+  }
+
+  bool blocked = false;
+  bvh.traverse(ray, min_t, max_t, [&](const int k) {
+    blocked = objects[k]->occluded(ray, min_t, max_t);
+    return blocked;
+  });
+  return blocked;
+}
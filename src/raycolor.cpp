@@ -1,50 +1,136 @@
 #include "raycolor.h"
-#include "first_hit.h"
 #include "blinn_phong_shading.h"
 #include "reflect.h"
+#include "RayStats.h"
 
-bool raycolor(
-  const Ray & ray, 
-  const double min_t,
+// Shade a path whose first hit is known, following mirror reflections
+static void shade_path(
+  const Ray & ray,
+  int hit_id,
+  int hit_part,
+  double t,
+  Eigen::Vector3d n,
   const std::vector< std::shared_ptr<Object> > & objects,
+  const CompiledScene & scene,
   const std::vector< std::shared_ptr<Light> > & lights,
-  const int num_recursive_calls,
+  const RaycolorOptions & options,
+  const Sampler & sampler,
   Eigen::Vector3d & rgb)
 {
-   const double EPS = 1e-6;
-  rgb.setZero();
+  // Product of mirror coefficients along the path so far
+  Eigen::Vector3d throughput(1,1,1);
+  Ray current = ray;
+  double current_min_t = 0;
+  for(int depth = 0; ; ++depth)
+  {
+    // 1) Find first intersection (given for the first segment)
+    if(depth > 0 &&
+      !scene.first_hit(current, current_min_t, hit_id, hit_part, t, n))
+    {
+      // no hit → background (black)
+      return;
+    }
+
+    // 2) Local shading (ambient + diffuse + specular + shadows)
+    rgb += throughput.cwiseProduct(
+      blinn_phong_shading(current, hit_id, hit_part, t, n, objects, scene, lights));
+
+    // 3) Mirror reflection
+    const Material &mat = objects[hit_id]->part_material(hit_part);
+    if(!raycolor_bounce(
+      current, t, n, mat, depth, options, sampler,
+      throughput, current, current_min_t))
+    {
+      return;
+    }
+    thread_ray_stats().reflection++;
+  }
+}
+
+bool raycolor_bounce(
+  const Ray & ray,
+  const double t,
+  const Eigen::Vector3d & n,
+  const Material & mat,
+  const int depth,
+  const RaycolorOptions & options,
+  const Sampler & sampler,
+  Eigen::Vector3d & throughput,
+  Ray & next,
+  double & next_min_t)
+{
+  const double EPS = 1e-6;
 
-  // 1) Find first intersection
-  int hit_id; double t; Eigen::Vector3d n;
-  if(!first_hit(ray, min_t, objects, hit_id, t, n))
+  // Depth limit; km is mirror coefficient
+  if(depth >= options.max_depth || mat.km.maxCoeff() <= 0.0)
   {
-    // no hit → background (black)
     return false;
   }
+  throughput = throughput.cwiseProduct(mat.km);
 
-  // 2) Local shading (ambient + diffuse + specular + shadows)
-  rgb = blinn_phong_shading(ray, hit_id, t, n, objects, lights);
+  // Stop once the reflection can no longer visibly contribute
+  const double weight = throughput.maxCoeff();
+  if(weight < options.min_throughput)
+  {
+    if(!options.russian_roulette)
+    {
+      return false;
+    }
+    const double survive = weight / options.min_throughput;
+    if(sampler.uniform(SAMPLE_ROULETTE + depth) >= survive)
+    {
+      return false;
+    }
+    throughput /= survive;
+  }
 
-  // 3) Recursive mirror reflection (depth limit; km is mirror coefficient)
-  const Material &mat = *objects[hit_id]->material;
+  // construct mirror ray (ray and next may be the same)
+  const Eigen::Vector3d p = ray.origin + t * ray.direction;
+  next.direction = reflect(ray.direction, n);
+  next.origin    = p + EPS * n;
+  next_min_t = EPS;
+  return true;
+}
 
-  // set a reasonable max recursion depth
-  const int MAX_DEPTH = 9;
-  if(num_recursive_calls < MAX_DEPTH && mat.km.maxCoeff() > 0.0)
+bool raycolor(
+  const Ray & ray, 
+  const double min_t,
+  const std::vector< std::shared_ptr<Object> > & objects,
+  const CompiledScene & scene,
+  const std::vector< std::shared_ptr<Light> > & lights,
+  const RaycolorOptions & options,
+  const Sampler & sampler,
+  Eigen::Vector3d & rgb)
+{
+  int hit_id, hit_part; double t; Eigen::Vector3d n;
+  const bool hit = scene.first_hit(ray, min_t, hit_id, hit_part, t, n);
+  return raycolor_from_hit(
+    ray, hit, hit_id, hit_part, t, n,
+    objects, scene, lights, options, sampler, rgb);
+}
+
+bool raycolor_from_hit(
+  const Ray & ray,
+  const bool hit,
+  const int hit_id,
+  const int hit_part,
+  const double t,
+  const Eigen::Vector3d & n,
+  const std::vector< std::shared_ptr<Object> > & objects,
+  const CompiledScene & scene,
+  const std::vector< std::shared_ptr<Light> > & lights,
+  const RaycolorOptions & options,
+  const Sampler & sampler,
+  Eigen::Vector3d & rgb)
+{
+  rgb.setZero();
+  thread_ray_stats().primary++;
+  if(!hit)
   {
-    // construct mirror ray
-    const Eigen::Vector3d p = ray.origin + t * ray.direction;
-    Ray mirror_ray;
-    mirror_ray.origin    = p + EPS * n;                 
-    mirror_ray.direction = reflect(ray.direction, n);
-
-    Eigen::Vector3d rec_rgb(0,0,0);
-    // recurse
-    raycolor(mirror_ray, EPS, objects, lights, num_recursive_calls + 1, rec_rgb);
-
-    // accumulate with mirror coefficient (component-wise)
-    rgb += mat.km.cwiseProduct(rec_rgb);
+    return false;
   }
-
+  shade_path(
+    ray, hit_id, hit_part, t, n,
+    objects, scene, lights, options, sampler, rgb);
   return true;
 }
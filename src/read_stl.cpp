@@ -0,0 +1,255 @@
+#include "read_stl.h"
+#include "readSTL.h"
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory map of a whole file (unmapped on destruction)
+class MappedFile
+{
+  public:
+    const unsigned char * data = nullptr;
+    std::size_t size = 0;
+
+    explicit MappedFile(const std::string & filename)
+    {
+#ifdef _WIN32
+      file = CreateFileA(
+        filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+      if(file == INVALID_HANDLE_VALUE) return;
+      LARGE_INTEGER file_size;
+      if(!GetFileSizeEx(file, &file_size)) return;
+      size = static_cast<std::size_t>(file_size.QuadPart);
+      opened = true;
+      if(size == 0) return;
+      mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+      if(!mapping) { opened = false; return; }
+      data = static_cast<const unsigned char *>(
+        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+      if(!data) opened = false;
+#else
+      fd = open(filename.c_str(), O_RDONLY);
+      if(fd < 0) return;
+      struct stat st;
+      if(fstat(fd, &st) != 0) return;
+      size = static_cast<std::size_t>(st.st_size);
+      opened = true;
+      if(size == 0) return;
+      void * map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if(map == MAP_FAILED) { opened = false; return; }
+      // Faces are decoded front to back exactly once
+      madvise(map, size, MADV_SEQUENTIAL);
+      data = static_cast<const unsigned char *>(map);
+#endif
+    }
+    ~MappedFile()
+    {
+#ifdef _WIN32
+      if(data) UnmapViewOfFile(data);
+      if(mapping) CloseHandle(mapping);
+      if(file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+      if(data) munmap(const_cast<unsigned char *>(data), size);
+      if(fd >= 0) close(fd);
+#endif
+    }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile & operator=(const MappedFile &) = delete;
+
+    // Returns true iff the file could be opened and (if non-empty) mapped
+    bool ok() const { return opened; }
+
+  private:
+    bool opened = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+// Little-endian 32-bit unsigned integer at p
+static std::uint32_t read_uint32(const unsigned char * p)
+{
+  return
+    static_cast<std::uint32_t>(p[0]) |
+    (static_cast<std::uint32_t>(p[1]) << 8) |
+    (static_cast<std::uint32_t>(p[2]) << 16) |
+    (static_cast<std::uint32_t>(p[3]) << 24);
+}
+
+// Little-endian IEEE float at p
+static float read_float(const unsigned char * p)
+{
+  const std::uint32_t bits = read_uint32(p);
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+static bool starts_with_solid(const unsigned char * data, const std::size_t size)
+{
+  std::size_t k = 0;
+  while(k < size && (data[k] == ' ' || data[k] == '\t')) ++k;
+  return size - k >= 5 && std::memcmp(data + k, "solid", 5) == 0;
+}
+
+// Merges corners with bitwise equal positions while they are appended, using
+// an open addressing hash table sized for the number of corners up front (no
+// allocation per vertex)
+class VertexWelder
+{
+  public:
+    VertexWelder(
+      const std::size_t num_corners,
+      std::vector<float> & V,
+      std::vector<std::uint32_t> & F)
+      : V(V), F(F)
+    {
+      std::size_t size = 16;
+      while(size < 2 * num_corners) size *= 2;
+      table.assign(size, EMPTY);
+      V.clear();
+      F.clear();
+      V.reserve(3 * num_corners);
+      F.reserve(num_corners);
+    }
+    // Closed meshes weld to about a sixth as many vertices as corners: give
+    // back the rest of the reservation
+    ~VertexWelder() { V.shrink_to_fit(); }
+
+    void add_corner(const float x, const float y, const float z)
+    {
+      std::uint32_t bits[3];
+      std::memcpy(bits + 0, &x, 4);
+      std::memcpy(bits + 1, &y, 4);
+      std::memcpy(bits + 2, &z, 4);
+      std::uint64_t h =
+        (bits[0] * 0x9e3779b97f4a7c15ull) ^
+        (bits[1] * 0xc2b2ae3d27d4eb4full) ^
+        (bits[2] * 0x165667b19e3779f9ull);
+      h ^= h >> 29;
+      const std::size_t mask = table.size() - 1;
+      for(std::size_t slot = h & mask; ; slot = (slot + 1) & mask)
+      {
+        const std::uint32_t v = table[slot];
+        if(v == EMPTY)
+        {
+          table[slot] = static_cast<std::uint32_t>(V.size() / 3);
+          F.push_back(table[slot]);
+          V.push_back(x);
+          V.push_back(y);
+          V.push_back(z);
+          return;
+        }
+        if(std::memcmp(&V[3*v], bits, 12) == 0)
+        {
+          F.push_back(v);
+          return;
+        }
+      }
+    }
+
+  private:
+    static constexpr std::uint32_t EMPTY = 0xffffffffu;
+    std::vector<float> & V;
+    std::vector<std::uint32_t> & F;
+    std::vector<std::uint32_t> table;
+};
+
+bool read_stl(
+  const std::string & filename,
+  std::vector<float> & V,
+  std::vector<std::uint32_t> & F)
+{
+  V.clear();
+  F.clear();
+  const std::size_t HEADER_SIZE = 80 + 4;
+  const std::size_t RECORD_SIZE = 4*12 + 2;
+
+  {
+    MappedFile file(filename);
+    if(!file.ok())
+    {
+      std::cerr << "IOError: " << filename << " could not be opened..."
+                << std::endl;
+      return false;
+    }
+    bool is_binary = false;
+    std::size_t num_faces = 0;
+    if(file.size >= HEADER_SIZE)
+    {
+      num_faces = read_uint32(file.data + 80);
+      // ASCII files may not start with a valid face count, but binary files
+      // may start with "solid": trust the size first
+      is_binary =
+        file.size == HEADER_SIZE + RECORD_SIZE * num_faces ||
+        (!starts_with_solid(file.data, file.size) &&
+         file.size >= HEADER_SIZE + RECORD_SIZE * num_faces);
+    }
+    if(is_binary)
+    {
+      VertexWelder welder(3 * num_faces, V, F);
+      const unsigned char * record = file.data + HEADER_SIZE;
+      for(std::size_t f = 0; f < num_faces; ++f, record += RECORD_SIZE)
+      {
+        // Skip the facet normal (12 bytes); 3 corners follow
+        for(int c = 0; c < 3; ++c)
+        {
+          const unsigned char * p = record + 12 + 12*c;
+          welder.add_corner(read_float(p), read_float(p + 4), read_float(p + 8));
+        }
+      }
+      return true;
+    }
+    if(!starts_with_solid(file.data, file.size))
+    {
+      std::cerr << "IOError: " << filename
+                << " is neither a complete binary nor an ASCII .stl file."
+                << std::endl;
+      return false;
+    }
+  }
+
+  // ASCII fallback
+  std::vector<std::vector<double> > AV;
+  std::vector<std::vector<int> > AF;
+  std::vector<std::vector<double> > AN;
+  if(!igl::readSTL(filename, AV, AF, AN))
+  {
+    return false;
+  }
+  VertexWelder welder(3 * AF.size(), V, F);
+  for(const auto & face : AF)
+  {
+    if(face.size() != 3)
+    {
+      std::cerr << "IOError: " << filename << " has a non-triangle facet."
+                << std::endl;
+      V.clear();
+      F.clear();
+      return false;
+    }
+    for(const int v : face)
+    {
+      welder.add_corner(
+        static_cast<float>(AV[v][0]),
+        static_cast<float>(AV[v][1]),
+        static_cast<float>(AV[v][2]));
+    }
+  }
+  return true;
+}
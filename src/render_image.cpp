@@ -0,0 +1,153 @@
+#include "render_image.h"
+#include "Sampler.h"
+#include "camera_ray.h"
+#include "RayPacket.h"
+#include "post_process.h"
+#include <Eigen/Core>
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+
+int render_samples_per_pixel(
+  const Camera & camera,
+  const RenderSettings & settings)
+{
+  const bool random_samples =
+    camera_ray_is_random(camera, settings.jitter) ||
+    settings.path.russian_roulette;
+  return random_samples ? settings.samples_per_pixel : 1;
+}
+
+void render_image(
+  const Camera & camera,
+  const std::vector< std::shared_ptr<Object> > & objects,
+  const CompiledScene & scene,
+  const std::vector< std::shared_ptr<Light> > & lights,
+  const RenderSettings & settings,
+  ThreadPool & pool,
+  std::vector<unsigned char> & rgb_image,
+  RayStats & stats,
+  const std::function<void(const int, const int, const RayStats &)> & progress)
+{
+  const int width = settings.width;
+  const int height = settings.height;
+  const int traced_samples = render_samples_per_pixel(camera, settings);
+  // Blocks of at most RayPacket::SIZE pixels
+  const int packet_size = std::min(settings.packet_size, 8);
+  rgb_image.resize(3*width*height);
+  stats = RayStats();
+
+  const int TILE_SIZE = 32;
+  const int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+  const int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+  const int num_tiles = tiles_x * tiles_y;
+
+  int tiles_done = 0;
+  std::mutex stats_mutex;
+
+  auto render_tile = [&](const int tile)
+  {
+    const int i0 = (tile / tiles_x) * TILE_SIZE;
+    const int j0 = (tile % tiles_x) * TILE_SIZE;
+    const int i1 = std::min(i0 + TILE_SIZE, height);
+    const int j1 = std::min(j0 + TILE_SIZE, width);
+    const RayStats stats_before = thread_ray_stats();
+
+    // Average the samples of pixel (i,j) and write it out
+    auto write_pixel = [&](const int i, const int j, Eigen::Vector3d rgb)
+    {
+      rgb /= double(traced_samples);
+
+      // Apply film photography post-processing effects
+      rgb = apply_warm_grading(rgb, 0.3);        // Warm vintage look
+      rgb = apply_vignetting(rgb, i, j, width, height, 0.6);  // Stronger lens vignetting
+      rgb = apply_film_grain(rgb, i, j, 0.025);   // More visible film grain
+
+      // Write double precision color into image
+      auto clamp = [](double s){ return std::max(std::min(s,1.0),0.0);};
+      rgb_image[0+3*(j+width*i)] = 255.0*clamp(rgb(0));
+      rgb_image[1+3*(j+width*i)] = 255.0*clamp(rgb(1));
+      rgb_image[2+3*(j+width*i)] = 255.0*clamp(rgb(2));
+    };
+
+    if (packet_size <= 1) {
+      // For each pixel (i,j)
+      for(int i=i0; i<i1; ++i)
+      {
+        for(int j=j0; j<j1; ++j)
+        {
+          // Accumulate color from multiple samples
+          Eigen::Vector3d rgb(0,0,0);
+
+          // Multiple samples per pixel for anti-aliasing and depth of field
+          for (int s = 0; s < traced_samples; ++s) {
+            Eigen::Vector3d sample_color(0,0,0);
+
+            // Random numbers are a pure function of (seed, i, j, s) so the
+            // image does not depend on which thread renders which tile
+            const Sampler sampler(settings.seed, i, j, s);
+            Ray ray;
+            camera_ray(camera, i, j, width, height, settings.jitter, sampler, ray);
+
+            // Shoot ray and collect color
+            raycolor(
+              ray, 1.0, objects, scene, lights, settings.path, sampler, sample_color);
+            rgb += sample_color;
+          }
+          write_pixel(i, j, rgb);
+        }
+      }
+    } else {
+      // For each block of pixels, trace sample s of all its pixels together.
+      // Every pixel still sums its samples in order s = 0,1,..., so the image
+      // is bit-identical to the single-ray loop above.
+      for (int bi = i0; bi < i1; bi += packet_size) {
+        for (int bj = j0; bj < j1; bj += packet_size) {
+          const int rows = std::min(packet_size, i1 - bi);
+          const int cols = std::min(packet_size, j1 - bj);
+          Eigen::Vector3d rgb[RayPacket::SIZE];
+          for (int l = 0; l < rows * cols; ++l) rgb[l].setZero();
+
+          RayPacket packet;
+          packet.count = rows * cols;
+          int hit_id[RayPacket::SIZE], hit_part[RayPacket::SIZE];
+          double t[RayPacket::SIZE];
+          Eigen::Vector3d n[RayPacket::SIZE];
+          for (int s = 0; s < traced_samples; ++s) {
+            for (int l = 0; l < packet.count; ++l) {
+              const Sampler sampler(settings.seed, bi + l / cols, bj + l % cols, s);
+              Ray ray;
+              camera_ray(
+                camera, bi + l / cols, bj + l % cols, width, height,
+                settings.jitter, sampler, ray);
+              packet.set(l, ray);
+            }
+            const std::uint64_t hits =
+              scene.first_hit_packet(packet, 1.0, hit_id, hit_part, t, n);
+            for (int l = 0; l < packet.count; ++l) {
+              const Sampler sampler(settings.seed, bi + l / cols, bj + l % cols, s);
+              Eigen::Vector3d sample_color(0,0,0);
+              raycolor_from_hit(
+                packet.ray(l), ((hits >> l) & 1) != 0,
+                hit_id[l], hit_part[l], t[l], n[l],
+                objects, scene, lights, settings.path, sampler, sample_color);
+              rgb[l] += sample_color;
+            }
+          }
+          for (int l = 0; l < packet.count; ++l) {
+            write_pixel(bi + l / cols, bj + l % cols, rgb[l]);
+          }
+        }
+      }
+    }
+
+    const RayStats tile_stats = thread_ray_stats() - stats_before;
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    stats += tile_stats;
+    ++tiles_done;
+    if (progress) {
+      progress(tiles_done, num_tiles, stats);
+    }
+  };
+  pool.parallel_for(num_tiles, render_tile);
+}
@@ -7,13 +7,15 @@ void viewing_ray_dof(
   const int j,
   const int width,
   const int height,
+  const double px,
+  const double py,
   const double u,
   const double v,
   Ray & ray)
 {
-  // Pixel center offsets in scene units on the image plane
-  const double sx = ( (j + 0.5) / static_cast<double>(width)  - 0.5 ) * camera.width;
-  const double sy = -( (i + 0.5) / static_cast<double>(height) - 0.5 ) * camera.height;
+  // Offsets of the (jittered) pixel sample in scene units on the image plane
+  const double sx = ( (j + px) / static_cast<double>(width)  - 0.5 ) * camera.width;
+  const double sy = -( (i + py) / static_cast<double>(height) - 0.5 ) * camera.height;
 
   // Point on the image plane (pinhole camera)
   const Eigen::Vector3d p_image =
@@ -22,6 +24,13 @@ void viewing_ray_dof(
     + sx * camera.u
     + sy * camera.v;
 
+  // If aperture is 0, this is a pinhole camera (no DOF)
+  if (camera.aperture <= 0.0) {
+    ray.origin = camera.e;
+    ray.direction = (p_image - camera.e);
+    return;
+  }
+
   // Direction from pinhole to image plane point
   Eigen::Vector3d ray_dir = (p_image - camera.e).normalized();
 
@@ -35,13 +44,6 @@ void viewing_ray_dof(
   double t_focal = (focal_center - camera.e).dot(-camera.w) / denom;
   Eigen::Vector3d focal_point = camera.e + t_focal * ray_dir;
 
-  // If aperture is 0, this is a pinhole camera (no DOF)
-  if (camera.aperture <= 0.0) {
-    ray.origin = camera.e;
-    ray.direction = ray_dir;
-    return;
-  }
-
   // Sample a random point on the lens (thin lens approximation)
   Eigen::Vector2d disk_sample = random_disk_sample(u, v);
   Eigen::Vector3d lens_point = camera.e